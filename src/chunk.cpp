@@ -1,10 +1,15 @@
 #include "chunk.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <functional>
+#include <initializer_list>
 #include <iomanip>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/endian/conversion.hpp>
@@ -40,37 +45,119 @@ namespace motts::lox
         return os;
     }
 
-    Chunk::Jump_backpatch::Jump_backpatch(std::vector<std::uint8_t>& bytecode)
-        : bytecode_{bytecode},
-          jump_begin_index_{bytecode.size()}
+    Chunk::Jump_backpatch::Jump_backpatch(Chunk& chunk)
+        : chunk_{chunk},
+          jump_begin_index_{chunk.bytecode_.size()}
     {
     }
 
     void Chunk::Jump_backpatch::to_next_opcode()
     {
-        const auto jump_distance = gsl::narrow<std::uint16_t>(bytecode_.size() - jump_begin_index_);
-        const auto jump_distance_big_endian = boost::endian::native_to_big(jump_distance);
-        reinterpret_cast<std::uint16_t&>(bytecode_.at(jump_begin_index_ - 2)) = jump_distance_big_endian;
+        const auto jump_distance = chunk_.bytecode_.size() - jump_begin_index_;
+        if (jump_distance > UINT16_MAX) {
+            chunk_.far_jump_targets_[jump_begin_index_ - 3] = chunk_.bytecode_.size();
+            return;
+        }
+
+        const auto jump_distance_big_endian = boost::endian::native_to_big(gsl::narrow<std::uint16_t>(jump_distance));
+        reinterpret_cast<std::uint16_t&>(chunk_.bytecode_.at(jump_begin_index_ - 2)) = jump_distance_big_endian;
+    }
+
+    void Chunk::update_refs(GC_heap& gc_heap)
+    {
+        // The index is keyed by address, so drop it and let the next insert rebuild it.
+        constant_indexes_.clear();
+        for (auto& constant : constants_) {
+            update_ref(gc_heap, constant);
+        }
+        for (auto& source_map_token : source_map_tokens_) {
+            update_ref(gc_heap, source_map_token.lexeme);
+        }
+        for (auto& inline_cache : inline_caches_) {
+            update_ref(gc_heap, inline_cache.shape);
+            update_ref(gc_heap, inline_cache.next_shape);
+            update_ref(gc_heap, inline_cache.method);
+        }
+    }
+
+    std::size_t Chunk::Constant_hash::operator()(Dynamic_type_value value) const
+    {
+        return visit_value(
+            [](const auto& value) -> std::size_t {
+                using Value_type = std::decay_t<decltype(value)>;
+                if constexpr (std::is_same_v<Value_type, std::nullptr_t>) {
+                    return 0;
+                } else if constexpr (std::is_same_v<Value_type, double>) {
+                    return std::hash<std::uint64_t>{}(std::bit_cast<std::uint64_t>(value));
+                } else {
+                    return std::hash<Value_type>{}(value);
+                }
+            },
+            value
+        );
+    }
+
+    bool Chunk::Same_constant::operator()(Dynamic_type_value lhs, Dynamic_type_value rhs) const
+    {
+        const auto maybe_double_lhs = try_as<double>(lhs);
+        const auto maybe_double_rhs = try_as<double>(rhs);
+        if (maybe_double_lhs && maybe_double_rhs) {
+            return std::bit_cast<std::uint64_t>(*maybe_double_lhs) == std::bit_cast<std::uint64_t>(*maybe_double_rhs);
+        }
+
+        return lhs == rhs;
     }
 
     std::size_t Chunk::insert_constant(Dynamic_type_value value)
     {
-        const auto maybe_duplicate_iter = std::find(constants_.cbegin(), constants_.cend(), value);
-        if (maybe_duplicate_iter != constants_.cend()) {
-            const auto constant_index = maybe_duplicate_iter - constants_.cbegin();
-            return gsl::narrow<std::size_t>(constant_index);
+        if (constant_indexes_.size() != constants_.size()) {
+            constant_indexes_.clear();
+            for (std::size_t constant_index = 0; constant_index != constants_.size(); ++constant_index) {
+                constant_indexes_.emplace(constants_[constant_index], constant_index);
+            }
         }
 
-        const auto constant_index = constants_.size();
-        constants_.push_back(value);
+        const auto [constant_index_iter, inserted] = constant_indexes_.emplace(value, constants_.size());
+        if (inserted) {
+            constants_.push_back(value);
+            global_slot_indexes_.push_back(0);
+        }
 
-        return constant_index;
+        return constant_index_iter->second;
     }
 
     void Chunk::emit(std::uint8_t byte, const Source_map_token& token)
     {
         bytecode_.push_back(byte);
         source_map_tokens_.push_back(token);
+        inline_cache_indexes_.push_back(0);
+    }
+
+    void Chunk::add_inline_cache()
+    {
+        inline_cache_indexes_.back() = gsl::narrow<std::uint32_t>(inline_caches_.size());
+        inline_caches_.emplace_back();
+    }
+
+    void Chunk::emit_opcode(Opcode opcode, bool wide, const Source_map_token& token)
+    {
+        if (wide) {
+            emit(gsl::narrow<std::uint8_t>(Opcode::wide), token);
+        }
+        emit(gsl::narrow<std::uint8_t>(opcode), token);
+    }
+
+    void Chunk::emit_operand(std::size_t operand, bool wide, const Source_map_token& token)
+    {
+        if (! wide) {
+            emit(gsl::narrow<std::uint8_t>(operand), token);
+            return;
+        }
+
+        const auto operand_big_endian = boost::endian::native_to_big(gsl::narrow<std::uint16_t>(operand));
+        emit(0, token);
+        emit(0, token);
+        reinterpret_cast<std::uint16_t&>(*(bytecode_.end() - 2)) = operand_big_endian;
     }
 
     template<Opcode opcode>
@@ -99,28 +186,46 @@ namespace motts::lox
     template void Chunk::emit<Opcode::true_>(const Source_map_token&);
 
     template<Opcode opcode>
-    void Chunk::emit(GC_ptr<const std::string> identifier_name, const Source_map_token& token)
+    void Chunk::emit(GC_ptr<const String> identifier_name, const Source_map_token& token)
     {
         const auto constant_index = insert_constant(identifier_name);
+        const auto wide = constant_index > UINT8_MAX;
 
-        emit(gsl::narrow<std::uint8_t>(opcode), token);
-        emit(gsl::narrow<std::uint8_t>(constant_index), token);
+        emit_opcode(opcode, wide, token);
+        if constexpr (opcode == Opcode::get_property || opcode == Opcode::set_property) {
+            add_inline_cache();
+        }
+        emit_operand(constant_index, wide, token);
+    }
+
+    template void Chunk::emit<Opcode::class_>(GC_ptr<const String>, const Source_map_token&);
+    template void Chunk::emit<Opcode::get_property>(GC_ptr<const String>, const Source_map_token&);
+    template void Chunk::emit<Opcode::get_super>(GC_ptr<const String>, const Source_map_token&);
+    template void Chunk::emit<Opcode::method>(GC_ptr<const String>, const Source_map_token&);
+    template void Chunk::emit<Opcode::set_property>(GC_ptr<const String>, const Source_map_token&);
+
+    template<Opcode opcode>
+    void Chunk::emit(GC_ptr<const String> global_name, std::size_t global_slot_index, const Source_map_token& token)
+    {
+        const auto constant_index = insert_constant(global_name);
+        global_slot_indexes_.at(constant_index) = global_slot_index;
+        const auto wide = constant_index > UINT8_MAX;
+
+        emit_opcode(opcode, wide, token);
+        emit_operand(constant_index, wide, token);
     }
 
-    template void Chunk::emit<Opcode::class_>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::define_global>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::get_global>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::get_property>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::get_super>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::method>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::set_global>(GC_ptr<const std::string>, const Source_map_token&);
-    template void Chunk::emit<Opcode::set_property>(GC_ptr<const std::string>, const Source_map_token&);
+    template void Chunk::emit<Opcode::define_global>(GC_ptr<const String>, std::size_t, const Source_map_token&);
+    template void Chunk::emit<Opcode::get_global>(GC_ptr<const String>, std::size_t, const Source_map_token&);
+    template void Chunk::emit<Opcode::set_global>(GC_ptr<const String>, std::size_t, const Source_map_token&);
 
     template<Opcode opcode>
     void Chunk::emit(unsigned int index, const Source_map_token& token)
     {
-        emit(gsl::narrow<std::uint8_t>(opcode), token);
-        emit(gsl::narrow<std::uint8_t>(index), token);
+        const auto wide = index > UINT8_MAX;
+
+        emit_opcode(opcode, wide, token);
+        emit_operand(index, wide, token);
     }
 
     template void Chunk::emit<Opcode::get_local>(unsigned int, const Source_map_token&);
@@ -130,38 +235,65 @@ namespace motts::lox
 
     void Chunk::emit_call(unsigned int arg_count, const Source_map_token& token)
     {
-        emit(gsl::narrow<std::uint8_t>(Opcode::call), token);
-        emit(gsl::narrow<std::uint8_t>(arg_count), token);
+        const auto wide = arg_count > UINT8_MAX;
+
+        emit_opcode(Opcode::call, wide, token);
+        emit_operand(arg_count, wide, token);
+    }
+
+    template<Opcode opcode>
+    void Chunk::emit_invoke(GC_ptr<const String> method_name, unsigned int arg_count, const Source_map_token& token)
+    {
+        const auto constant_index = insert_constant(method_name);
+        const auto wide = constant_index > UINT8_MAX || arg_count > UINT8_MAX;
+
+        emit_opcode(opcode, wide, token);
+        if constexpr (opcode == Opcode::invoke) {
+            add_inline_cache();
+        }
+        emit_operand(constant_index, wide, token);
+        emit_operand(arg_count, wide, token);
     }
 
+    template void Chunk::emit_invoke<Opcode::invoke>(GC_ptr<const String>, unsigned int, const Source_map_token&);
+    template void Chunk::emit_invoke<Opcode::super_invoke>(GC_ptr<const String>, unsigned int, const Source_map_token&);
+
     void Chunk::emit_closure(GC_ptr<Function> fn, const std::vector<Tracked_upvalue>& tracked_upvalues, const Source_map_token& token)
     {
         const auto fn_constant_index = insert_constant(fn);
 
-        emit(gsl::narrow<std::uint8_t>(Opcode::closure), token);
-        emit(gsl::narrow<std::uint8_t>(fn_constant_index), token);
-        emit(gsl::narrow<std::uint8_t>(tracked_upvalues.size()), token);
-
+        // To match clox opcodes (which isn't necessarily important to do),
+        // a `1` means parent local, and a `0` means parent upvalue.
+        std::vector<std::pair<unsigned int, unsigned int>> captures;
         for (const auto& tracked_upvalue : tracked_upvalues) {
-            // To match clox opcodes (which isn't necessarily important to do),
-            // a `1` means parent local, and a `0` means parent upvalue.
             if (const auto* upvalue = std::get_if<Upvalue_index>(&tracked_upvalue)) {
-                emit(1, token);
-                emit(gsl::narrow<std::uint8_t>(upvalue->enclosing_locals_index), token);
+                captures.emplace_back(1, upvalue->enclosing_locals_index);
             } else {
-                const auto& upupvalue = std::get<UpUpvalue_index>(tracked_upvalue);
-                emit(0, token);
-                emit(gsl::narrow<std::uint8_t>(upupvalue.enclosing_upvalues_index), token);
+                captures.emplace_back(0, std::get<UpUpvalue_index>(tracked_upvalue).enclosing_upvalues_index);
             }
         }
+
+        const auto wide =
+            fn_constant_index > UINT8_MAX || captures.size() > UINT8_MAX
+            || std::any_of(captures.cbegin(), captures.cend(), [](const auto& capture) { return capture.second > UINT8_MAX; });
+
+        emit_opcode(Opcode::closure, wide, token);
+        emit_operand(fn_constant_index, wide, token);
+        emit_operand(captures.size(), wide, token);
+
+        for (const auto& [is_direct_capture, enclosing_index] : captures) {
+            emit_operand(is_direct_capture, wide, token);
+            emit_operand(enclosing_index, wide, token);
+        }
     }
 
     void Chunk::emit_constant(Dynamic_type_value value, const Source_map_token& token)
     {
         const auto constant_index = insert_constant(value);
+        const auto wide = constant_index > UINT8_MAX;
 
-        emit(gsl::narrow<std::uint8_t>(Opcode::constant), token);
-        emit(gsl::narrow<std::uint8_t>(constant_index), token);
+        emit_opcode(Opcode::constant, wide, token);
+        emit_operand(constant_index, wide, token);
     }
 
     Chunk::Jump_backpatch Chunk::emit_jump(const Source_map_token& token)
@@ -170,7 +302,7 @@ namespace motts::lox
         emit(0, token);
         emit(0, token);
 
-        return Jump_backpatch{bytecode_};
+        return Jump_backpatch{*this};
     }
 
     Chunk::Jump_backpatch Chunk::emit_jump_if_false(const Source_map_token& token)
@@ -179,7 +311,7 @@ namespace motts::lox
         emit(0, token);
         emit(0, token);
 
-        return Jump_backpatch{bytecode_};
+        return Jump_backpatch{*this};
     }
 
     void Chunk::emit_loop(unsigned int loop_begin_bytecode_index, const Source_map_token& token)
@@ -188,19 +320,383 @@ namespace motts::lox
         emit(0, token);
         emit(0, token);
 
-        const auto jump_distance = gsl::narrow<std::uint16_t>(bytecode_.size() - loop_begin_bytecode_index);
-        const auto jump_distance_big_endian = boost::endian::native_to_big(jump_distance);
+        const auto jump_distance = bytecode_.size() - loop_begin_bytecode_index;
+        if (jump_distance > UINT16_MAX) {
+            far_jump_targets_[bytecode_.size() - 3] = loop_begin_bytecode_index;
+            return;
+        }
+
+        const auto jump_distance_big_endian = boost::endian::native_to_big(gsl::narrow<std::uint16_t>(jump_distance));
         reinterpret_cast<std::uint16_t&>(*(bytecode_.end() - 2)) = jump_distance_big_endian;
     }
 
+    // The number of bytes an opcode and its operands take, beginning at the opcode, or at its wide prefix.
+    static std::size_t opcode_size(const std::vector<std::uint8_t>& bytecode, std::size_t opcode_index)
+    {
+        switch (static_cast<Opcode>(bytecode.at(opcode_index))) {
+            default: {
+                throw std::logic_error{"Unexpected opcode."};
+            }
+
+            case Opcode::add:
+            case Opcode::close_upvalue:
+            case Opcode::divide:
+            case Opcode::equal:
+            case Opcode::false_:
+            case Opcode::greater:
+            case Opcode::greater_equal:
+            case Opcode::inherit:
+            case Opcode::less:
+            case Opcode::less_equal:
+            case Opcode::multiply:
+            case Opcode::negate:
+            case Opcode::nil:
+            case Opcode::not_:
+            case Opcode::not_equal:
+            case Opcode::pop:
+            case Opcode::print:
+            case Opcode::return_:
+            case Opcode::subtract:
+            case Opcode::true_:
+                return 1;
+
+            case Opcode::call:
+            case Opcode::class_:
+            case Opcode::constant:
+            case Opcode::define_global:
+            case Opcode::get_global:
+            case Opcode::get_local:
+            case Opcode::get_property:
+            case Opcode::get_super:
+            case Opcode::get_upvalue:
+            case Opcode::method:
+            case Opcode::set_global:
+            case Opcode::set_local:
+            case Opcode::set_property:
+            case Opcode::set_upvalue:
+                return 2;
+
+            case Opcode::add_local_constant:
+            case Opcode::invoke:
+            case Opcode::jump:
+            case Opcode::jump_if_false:
+            case Opcode::jump_if_false_pop:
+            case Opcode::loop:
+            case Opcode::super_invoke:
+                return 3;
+
+            case Opcode::closure:
+                return 3 + 2 * bytecode.at(opcode_index + 2);
+
+            // Every operand byte of the wide opcode becomes two.
+            case Opcode::wide: {
+                if (static_cast<Opcode>(bytecode.at(opcode_index + 1)) == Opcode::closure) {
+                    const auto n_upvalues_big_endian = reinterpret_cast<const std::uint16_t&>(bytecode.at(opcode_index + 4));
+                    return 6 + 4 * boost::endian::big_to_native(n_upvalues_big_endian);
+                }
+
+                return 2 + 2 * (opcode_size(bytecode, opcode_index + 1) - 1);
+            }
+        }
+    }
+
+    static bool is_jump(Opcode opcode)
+    {
+        return opcode == Opcode::jump || opcode == Opcode::jump_if_false || opcode == Opcode::jump_if_false_pop || opcode == Opcode::loop;
+    }
+
+    // The bytecode index that a jump or loop opcode at this index lands on. Jumps too far for their 16 bits are looked up instead.
+    static std::size_t jump_target(
+        const std::vector<std::uint8_t>& bytecode,
+        const std::unordered_map<std::size_t, std::size_t>& far_jump_targets,
+        std::size_t opcode_index
+    )
+    {
+        const auto maybe_far_jump_target_iter = far_jump_targets.find(opcode_index);
+        if (maybe_far_jump_target_iter != far_jump_targets.cend()) {
+            return maybe_far_jump_target_iter->second;
+        }
+
+        const auto jump_distance_big_endian = reinterpret_cast<const std::uint16_t&>(bytecode.at(opcode_index + 1));
+        const auto jump_distance = boost::endian::big_to_native(jump_distance_big_endian);
+
+        return static_cast<Opcode>(bytecode.at(opcode_index)) == Opcode::loop ? opcode_index + 3 - jump_distance
+                                                                               : opcode_index + 3 + jump_distance;
+    }
+
+    void Chunk::optimize_peephole()
+    {
+        std::vector<std::size_t> opcode_indexes;
+        for (std::size_t opcode_index = 0; opcode_index != bytecode_.size(); opcode_index += opcode_size(bytecode_, opcode_index)) {
+            opcode_indexes.push_back(opcode_index);
+        }
+
+        // A sequence can be fused only if nothing jumps into the middle of it.
+        std::vector<unsigned int> n_jumps_to(bytecode_.size() + 1);
+        for (const auto opcode_index : opcode_indexes) {
+            if (is_jump(static_cast<Opcode>(bytecode_[opcode_index]))) {
+                ++n_jumps_to.at(jump_target(bytecode_, far_jump_targets_, opcode_index));
+            }
+        }
+
+        const auto matches = [&](std::size_t nth_opcode, std::initializer_list<Opcode> sequence) {
+            if (opcode_indexes.size() - nth_opcode < sequence.size()) {
+                return false;
+            }
+
+            for (auto sequence_iter = sequence.begin(); sequence_iter != sequence.end(); ++sequence_iter, ++nth_opcode) {
+                const auto opcode_index = opcode_indexes[nth_opcode];
+                if (static_cast<Opcode>(bytecode_[opcode_index]) != *sequence_iter
+                    || (sequence_iter != sequence.begin() && n_jumps_to[opcode_index]))
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        // Whether the opcode at the target is a pop that only this jump reaches, because nothing else jumps there
+        // and the opcode before it never falls through. Such a pop can be dropped if the jump pops instead.
+        const auto is_pop_only_jumped_to_from = [&](std::size_t jump_index, std::size_t target) {
+            const auto target_opcode_iter = std::lower_bound(opcode_indexes.cbegin(), opcode_indexes.cend(), target);
+            if (target <= jump_index || target_opcode_iter == opcode_indexes.cend() || *target_opcode_iter != target
+                || static_cast<Opcode>(bytecode_[target]) != Opcode::pop || n_jumps_to[target] != 1)
+            {
+                return false;
+            }
+
+            const auto preceding_opcode = static_cast<Opcode>(bytecode_[*(target_opcode_iter - 1)]);
+            return preceding_opcode == Opcode::jump || preceding_opcode == Opcode::loop || preceding_opcode == Opcode::return_;
+        };
+
+        std::vector<std::uint8_t> bytecode;
+        std::vector<Source_map_token> source_map_tokens;
+        std::vector<std::uint32_t> inline_cache_indexes;
+        const auto copy_byte = [&](std::uint8_t byte, std::size_t old_index) {
+            bytecode.push_back(byte);
+            source_map_tokens.push_back(source_map_tokens_[old_index]);
+            inline_cache_indexes.push_back(inline_cache_indexes_[old_index]);
+        };
+
+        // Where each old opcode landed, and the jumps whose distances must be recomputed once everything has landed.
+        std::vector<std::size_t> new_indexes(bytecode_.size() + 1);
+        std::vector<std::pair<std::size_t, std::size_t>> new_jump_indexes_and_old_targets;
+        std::vector<bool> dropped(bytecode_.size());
+
+        for (std::size_t nth_opcode = 0; nth_opcode != opcode_indexes.size();) {
+            const auto opcode_index = opcode_indexes[nth_opcode];
+            new_indexes[opcode_index] = bytecode.size();
+
+            if (dropped[opcode_index]) {
+                ++nth_opcode;
+                continue;
+            }
+
+            const auto fuse_negated_comparison = [&](Opcode comparison, Opcode fused) {
+                if (! matches(nth_opcode, {comparison, Opcode::not_})) {
+                    return false;
+                }
+
+                copy_byte(gsl::narrow<std::uint8_t>(fused), opcode_index);
+                nth_opcode += 2;
+
+                return true;
+            };
+            if (fuse_negated_comparison(Opcode::less, Opcode::greater_equal) || fuse_negated_comparison(Opcode::greater, Opcode::less_equal)
+                || fuse_negated_comparison(Opcode::equal, Opcode::not_equal))
+            {
+                continue;
+            }
+
+            // Both branches of an if, while, or for begin by popping the condition. When the false branch's pop is reached only
+            // by this jump, the pop can happen in the jump itself, before either branch. A for loop's true branch first jumps
+            // over the increment to the body, so its pop is at that jump's target instead.
+            if (static_cast<Opcode>(bytecode_[opcode_index]) == Opcode::jump_if_false
+                && is_pop_only_jumped_to_from(opcode_index, jump_target(bytecode_, far_jump_targets_, opcode_index)))
+            {
+                const auto old_target = jump_target(bytecode_, far_jump_targets_, opcode_index);
+
+                if (matches(nth_opcode, {Opcode::jump_if_false, Opcode::pop})) {
+                    dropped[old_target] = true;
+                    new_jump_indexes_and_old_targets.emplace_back(bytecode.size(), old_target + 1);
+                    copy_byte(gsl::narrow<std::uint8_t>(Opcode::jump_if_false_pop), opcode_index);
+                    copy_byte(0, opcode_index + 1);
+                    copy_byte(0, opcode_index + 2);
+                    nth_opcode += 2;
+                    continue;
+                }
+
+                const auto next_opcode_index = opcode_indexes[nth_opcode + 1];
+                if (matches(nth_opcode, {Opcode::jump_if_false, Opcode::jump})
+                    && is_pop_only_jumped_to_from(next_opcode_index, jump_target(bytecode_, far_jump_targets_, next_opcode_index)))
+                {
+                    const auto old_next_target = jump_target(bytecode_, far_jump_targets_, next_opcode_index);
+                    dropped[old_target] = true;
+                    dropped[old_next_target] = true;
+
+                    new_jump_indexes_and_old_targets.emplace_back(bytecode.size(), old_target + 1);
+                    copy_byte(gsl::narrow<std::uint8_t>(Opcode::jump_if_false_pop), opcode_index);
+                    copy_byte(0, opcode_index + 1);
+                    copy_byte(0, opcode_index + 2);
+
+                    new_jump_indexes_and_old_targets.emplace_back(bytecode.size(), old_next_target + 1);
+                    for (auto byte_index = next_opcode_index; byte_index != next_opcode_index + 3; ++byte_index) {
+                        copy_byte(bytecode_[byte_index], byte_index);
+                    }
+                    nth_opcode += 2;
+                    continue;
+                }
+            }
+
+            // An if without an else ends its then branch with a jump over the else branch's pop. Once that pop has moved
+            // into jump_if_false_pop, the jump leads to the very next opcode and does nothing.
+            if (static_cast<Opcode>(bytecode_[opcode_index]) == Opcode::jump) {
+                const auto old_target = jump_target(bytecode_, far_jump_targets_, opcode_index);
+                auto nth_skipped_opcode = nth_opcode + 1;
+                while (nth_skipped_opcode != opcode_indexes.size() && opcode_indexes[nth_skipped_opcode] < old_target
+                       && dropped[opcode_indexes[nth_skipped_opcode]])
+                {
+                    ++nth_skipped_opcode;
+                }
+
+                const auto skipped_index =
+                    nth_skipped_opcode != opcode_indexes.size() ? opcode_indexes[nth_skipped_opcode] : bytecode_.size();
+                if (skipped_index == old_target) {
+                    ++nth_opcode;
+                    continue;
+                }
+            }
+
+            // An assignment statement that adds a constant to a local, such as `i = i + 1;`, becomes one opcode
+            // that updates the local in place, rather than pushing and popping four values.
+            if (matches(nth_opcode, {Opcode::get_local, Opcode::constant, Opcode::add, Opcode::set_local, Opcode::pop})
+                && bytecode_[opcode_index + 1] == bytecode_[opcode_indexes[nth_opcode + 3] + 1])
+            {
+                copy_byte(gsl::narrow<std::uint8_t>(Opcode::add_local_constant), opcode_indexes[nth_opcode + 2]);
+                copy_byte(bytecode_[opcode_index + 1], opcode_index + 1);
+                copy_byte(bytecode_[opcode_indexes[nth_opcode + 1] + 1], opcode_indexes[nth_opcode + 1] + 1);
+                nth_opcode += 5;
+                continue;
+            }
+
+            const auto size = opcode_size(bytecode_, opcode_index);
+            if (is_jump(static_cast<Opcode>(bytecode_[opcode_index]))) {
+                new_jump_indexes_and_old_targets.emplace_back(bytecode.size(), jump_target(bytecode_, far_jump_targets_, opcode_index));
+            }
+            for (auto byte_index = opcode_index; byte_index != opcode_index + size; ++byte_index) {
+                copy_byte(bytecode_[byte_index], byte_index);
+            }
+            ++nth_opcode;
+        }
+        new_indexes[bytecode_.size()] = bytecode.size();
+
+        // A jump too far for 16 bits gets a wide prefix and a 32-bit distance, three bytes more. That moves everything after it,
+        // which may push other jumps out of range in turn, so keep widening until every jump fits.
+        std::vector<bool> wide_jumps(bytecode.size());
+        std::vector<std::size_t> widened_indexes(bytecode.size() + 1);
+        const auto jump_distance = [&](Opcode opcode, std::size_t new_jump_index, std::size_t old_target) -> std::size_t {
+            const auto jump_end = widened_indexes[new_jump_index] + (wide_jumps[new_jump_index] ? 6 : 3);
+            const auto target = widened_indexes[new_indexes[old_target]];
+            return opcode == Opcode::loop ? jump_end - target : target - jump_end;
+        };
+
+        for (auto widened_any = true; widened_any;) {
+            widened_any = false;
+
+            std::size_t n_widened_bytes = 0;
+            for (std::size_t index = 0; index != widened_indexes.size(); ++index) {
+                widened_indexes[index] = index + n_widened_bytes;
+                if (index != bytecode.size() && wide_jumps[index]) {
+                    n_widened_bytes += 3;
+                }
+            }
+
+            for (const auto& [new_jump_index, old_target] : new_jump_indexes_and_old_targets) {
+                const auto opcode = static_cast<Opcode>(bytecode[new_jump_index]);
+                if (! wide_jumps[new_jump_index] && jump_distance(opcode, new_jump_index, old_target) > UINT16_MAX) {
+                    wide_jumps[new_jump_index] = true;
+                    widened_any = true;
+                }
+            }
+        }
+
+        if (std::find(wide_jumps.cbegin(), wide_jumps.cend(), true) != wide_jumps.cend()) {
+            std::vector<std::uint8_t> widened_bytecode;
+            std::vector<Source_map_token> widened_source_map_tokens;
+            std::vector<std::uint32_t> widened_inline_cache_indexes;
+            const auto copy_widened_byte = [&](std::uint8_t byte, std::size_t index) {
+                widened_bytecode.push_back(byte);
+                widened_source_map_tokens.push_back(source_map_tokens[index]);
+                widened_inline_cache_indexes.push_back(inline_cache_indexes[index]);
+            };
+
+            for (std::size_t index = 0; index != bytecode.size(); ++index) {
+                if (! wide_jumps[index]) {
+                    copy_widened_byte(bytecode[index], index);
+                    continue;
+                }
+
+                copy_widened_byte(gsl::narrow<std::uint8_t>(Opcode::wide), index);
+                copy_widened_byte(bytecode[index], index);
+                for (auto n_distance_byte = 0; n_distance_byte != 4; ++n_distance_byte) {
+                    copy_widened_byte(0, index);
+                }
+                index += 2;
+            }
+
+            bytecode = std::move(widened_bytecode);
+            source_map_tokens = std::move(widened_source_map_tokens);
+            inline_cache_indexes = std::move(widened_inline_cache_indexes);
+        }
+
+        for (const auto& [new_jump_index, old_target] : new_jump_indexes_and_old_targets) {
+            const auto widened_jump_index = widened_indexes[new_jump_index];
+
+            if (wide_jumps[new_jump_index]) {
+                const auto opcode = static_cast<Opcode>(bytecode.at(widened_jump_index + 1));
+                const auto distance = gsl::narrow<std::uint32_t>(jump_distance(opcode, new_jump_index, old_target));
+                reinterpret_cast<std::uint32_t&>(bytecode.at(widened_jump_index + 2)) = boost::endian::native_to_big(distance);
+            } else {
+                const auto opcode = static_cast<Opcode>(bytecode.at(widened_jump_index));
+                const auto distance = gsl::narrow<std::uint16_t>(jump_distance(opcode, new_jump_index, old_target));
+                reinterpret_cast<std::uint16_t&>(bytecode.at(widened_jump_index + 1)) = boost::endian::native_to_big(distance);
+            }
+        }
+
+        bytecode_ = std::move(bytecode);
+        source_map_tokens_ = std::move(source_map_tokens);
+        inline_cache_indexes_ = std::move(inline_cache_indexes);
+        far_jump_targets_.clear();
+    }
+
+    void Chunk::end_compile()
+    {
+        constant_indexes_ = {};
+    }
+
     std::ostream& operator<<(std::ostream& os, const Chunk& chunk)
     {
         os << "Bytecode:\n";
+        auto wide = false;
         for (auto bytecode_iter = chunk.bytecode().cbegin(); bytecode_iter != chunk.bytecode().cend();) {
             const auto bytecode_index = bytecode_iter - chunk.bytecode().cbegin();
             const auto& token = chunk.source_map_tokens().at(bytecode_index);
             const auto opcode = static_cast<Opcode>(*bytecode_iter++);
 
+            // After a wide prefix, every operand is two bytes rather than one, and a jump distance is four rather than two.
+            const auto operand_is_wide = std::exchange(wide, false);
+            const auto operand_width = operand_is_wide ? 4 : 2;
+            const auto read_operand = [&]() -> int {
+                if (! operand_is_wide) {
+                    return *bytecode_iter++;
+                }
+
+                const auto operand_big_endian = reinterpret_cast<const std::uint16_t&>(*bytecode_iter);
+                bytecode_iter += 2;
+                return boost::endian::big_to_native(operand_big_endian);
+            };
+
             // Some opcodes such as closure will print multiple lines.
             std::vector<std::string> lines;
             std::ostringstream line;
@@ -219,12 +715,15 @@ namespace motts::lox
                 case Opcode::equal:
                 case Opcode::false_:
                 case Opcode::greater:
+                case Opcode::greater_equal:
                 case Opcode::inherit:
                 case Opcode::less:
+                case Opcode::less_equal:
                 case Opcode::multiply:
                 case Opcode::negate:
                 case Opcode::nil:
                 case Opcode::not_:
+                case Opcode::not_equal:
                 case Opcode::pop:
                 case Opcode::print:
                 case Opcode::return_:
@@ -234,10 +733,16 @@ namespace motts::lox
                     break;
                 }
 
+                case Opcode::wide: {
+                    line << "      " << opcode;
+                    wide = true;
+                    break;
+                }
+
                 case Opcode::call: {
-                    const auto arg_count = *bytecode_iter++;
-                    line << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(arg_count) << "    " << opcode << " ("
-                         << std::setbase(10) << static_cast<int>(arg_count) << ')';
+                    const auto arg_count = read_operand();
+                    line << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << arg_count << "    " << opcode << " ("
+                         << std::setbase(10) << arg_count << ')';
 
                     break;
                 }
@@ -255,49 +760,73 @@ namespace motts::lox
                 case Opcode::set_local:
                 case Opcode::set_property:
                 case Opcode::set_upvalue: {
-                    const auto lookup_index = *bytecode_iter++;
-                    line << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(lookup_index) << "    " << opcode
-                         << " [" << std::setbase(10) << static_cast<int>(lookup_index) << ']';
+                    const auto lookup_index = read_operand();
+                    line << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << lookup_index << "    " << opcode << " ["
+                         << std::setbase(10) << lookup_index << ']';
 
                     break;
                 }
 
                 case Opcode::closure: {
-                    const auto fn_constant_index = *bytecode_iter++;
-                    const auto n_tracked_upvalues = *bytecode_iter++;
+                    const auto fn_constant_index = read_operand();
+                    const auto n_tracked_upvalues = read_operand();
 
-                    line << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(fn_constant_index) << ' '
-                         << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(n_tracked_upvalues) << ' ' << opcode
-                         << " [" << std::setbase(10) << static_cast<int>(fn_constant_index) << "] (" << static_cast<int>(n_tracked_upvalues)
-                         << ')';
+                    line << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << fn_constant_index << ' '
+                         << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << n_tracked_upvalues << ' ' << opcode
+                         << " [" << std::setbase(10) << fn_constant_index << "] (" << n_tracked_upvalues << ')';
 
                     for (auto n_tracked_upvalue = 0; n_tracked_upvalue != n_tracked_upvalues; ++n_tracked_upvalue) {
-                        const auto is_direct_capture = *bytecode_iter++;
-                        const auto enclosing_index = *bytecode_iter++;
+                        const auto is_direct_capture = read_operand();
+                        const auto enclosing_index = read_operand();
 
                         lines.push_back(std::move(line).str());
-                        line << "           " << std::setw(2) << std::setfill('0') << std::setbase(16)
-                             << static_cast<int>(is_direct_capture) << ' ' << std::setw(2) << std::setfill('0') << std::setbase(16)
-                             << static_cast<int>(enclosing_index) << " | " << (is_direct_capture ? "^" : "^^") << " ["
-                             << static_cast<int>(enclosing_index) << ']';
+                        line << "           " << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << is_direct_capture
+                             << ' ' << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << enclosing_index << " | "
+                             << (is_direct_capture ? "^" : "^^") << " [" << enclosing_index << ']';
                     }
 
                     break;
                 }
 
+                case Opcode::invoke:
+                case Opcode::super_invoke: {
+                    const auto method_name_constant_index = read_operand();
+                    const auto arg_count = read_operand();
+
+                    line << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << method_name_constant_index << ' '
+                         << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << arg_count << ' ' << opcode << " ["
+                         << std::setbase(10) << method_name_constant_index << "] (" << arg_count << ')';
+
+                    break;
+                }
+
+                case Opcode::add_local_constant: {
+                    const auto local_stack_index = read_operand();
+                    const auto constant_index = read_operand();
+
+                    line << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << local_stack_index << ' '
+                         << std::setw(operand_width) << std::setfill('0') << std::setbase(16) << constant_index << ' ' << opcode << " ["
+                         << std::setbase(10) << local_stack_index << "] [" << constant_index << ']';
+
+                    break;
+                }
+
                 case Opcode::jump:
                 case Opcode::jump_if_false:
+                case Opcode::jump_if_false_pop:
                 case Opcode::loop: {
-                    const auto jump_distance_big_endian = reinterpret_cast<const std::uint16_t&>(*bytecode_iter);
-                    const auto jump_distance = boost::endian::big_to_native(jump_distance_big_endian);
-                    const auto jump_target = bytecode_index + 3 + jump_distance * (opcode == Opcode::loop ? -1 : 1);
+                    const auto jump_distance_size = operand_is_wide ? 4 : 2;
+                    std::uint32_t jump_distance = 0;
+                    for (auto n_distance_byte = 0; n_distance_byte != jump_distance_size; ++n_distance_byte) {
+                        const auto jump_distance_byte = *bytecode_iter++;
+                        jump_distance = jump_distance << 8 | jump_distance_byte;
+                        line << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(jump_distance_byte) << ' ';
+                    }
 
-                    const auto jump_distance_high_byte = *bytecode_iter++;
-                    const auto jump_distance_low_byte = *bytecode_iter++;
+                    const auto jump_end = bytecode_iter - chunk.bytecode().cbegin();
+                    const auto jump_target = opcode == Opcode::loop ? jump_end - jump_distance : jump_end + jump_distance;
 
-                    line << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(jump_distance_high_byte) << ' '
-                         << std::setw(2) << std::setfill('0') << std::setbase(16) << static_cast<int>(jump_distance_low_byte) << ' '
-                         << opcode << ' ' << (opcode == Opcode::loop ? '-' : '+') << std::setbase(10) << jump_distance << " -> "
+                    line << opcode << ' ' << (opcode == Opcode::loop ? '-' : '+') << std::setbase(10) << jump_distance << " -> "
                          << jump_target;
 
                     break;
@@ -322,8 +851,8 @@ namespace motts::lox
 
         // Recursively traverse nested functions.
         for (const auto value : chunk.constants()) {
-            if (std::holds_alternative<GC_ptr<Function>>(value)) {
-                os << '[' << value << " chunk]\n" << std::get<GC_ptr<Function>>(value)->chunk;
+            if (const auto maybe_function = try_as<GC_ptr<Function>>(value)) {
+                os << '[' << value << " chunk]\n" << (*maybe_function)->chunk;
             }
         }
 
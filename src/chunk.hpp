@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <ostream>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -15,6 +16,7 @@ namespace motts::lox
     // Internally, these opcodes could be listed in any order and work fine.
     // But for the generated opcode values to match clox opcodes
     // (which isn't necessarily important to do), then this order has to match clox.
+    // The fused opcodes that the peephole pass makes aren't in clox, so they come last, and so does the wide prefix.
     // X-macro technique to re-use this list in multiple places.
 
 #define MOTTS_LOX_OPCODE_NAMES \
@@ -54,7 +56,13 @@ namespace motts::lox
     X(return_) \
     X(class_) \
     X(inherit) \
-    X(method)
+    X(method) \
+    X(greater_equal) \
+    X(less_equal) \
+    X(not_equal) \
+    X(jump_if_false_pop) \
+    X(add_local_constant) \
+    X(wide)
 
     enum struct Opcode
     {
@@ -67,7 +75,7 @@ namespace motts::lox
 
     struct Source_map_token
     {
-        GC_ptr<const std::string> lexeme;
+        GC_ptr<const String> lexeme;
         unsigned int line;
     };
 
@@ -92,24 +100,69 @@ namespace motts::lox
 
     using Tracked_upvalue = std::variant<Upvalue_index, UpUpvalue_index>;
 
+    // Remembers what the last run of a property opcode found, so the next run with a receiver of the same shape
+    // can skip the hash lookups. Shapes belong to one class, so a shape match also means the same class and methods.
+    struct Inline_cache
+    {
+        // The receiver shape this entry was filled for. Null until the first run.
+        GC_ptr<Shape> shape;
+
+        // The field's index into the instance's field values.
+        std::size_t slot_index{0};
+
+        // Only for set_property when the write added a new field. The receiver moves to this shape.
+        GC_ptr<Shape> next_shape;
+
+        // Only for get_property and invoke when the name isn't a field but a method of the receiver's class.
+        GC_ptr<Closure> method;
+    };
+
     // A chunk of bytecode.
     class Chunk
     {
         std::vector<std::uint8_t> bytecode_;
         std::vector<Dynamic_type_value> constants_;
+
+        // Parallel to the constants. For a global name constant, the slot the compiler resolved it to.
+        std::vector<std::size_t> global_slot_indexes_;
         std::vector<Source_map_token> source_map_tokens_;
 
+        // One per get_property, set_property, and invoke opcode, so these grow with call sites rather than with bytecode.
+        std::vector<Inline_cache> inline_caches_;
+
+        // Parallel to the bytecode like the source map. At a property opcode, the index of its inline cache. Elsewhere unused.
+        std::vector<std::uint32_t> inline_cache_indexes_;
+
+        // Constants are deduplicated by identity rather than by Lox equality, which would merge 0 with -0.
+        struct Constant_hash
+        {
+            std::size_t operator()(Dynamic_type_value) const;
+        };
+
+        struct Same_constant
+        {
+            bool operator()(Dynamic_type_value, Dynamic_type_value) const;
+        };
+
+        // Maps each constant to its index, so that deduplicating doesn't search all the constants. Only compiling needs this,
+        // so it's freed once the chunk is complete. It's rebuilt from the constants if it's ever out of step with them.
+        std::unordered_map<Dynamic_type_value, std::size_t, Constant_hash, Same_constant> constant_indexes_;
+
+        // Jumps whose distance doesn't fit in their 16 bits, from the index of the jump opcode to the index it lands on.
+        // Widening a jump while compiling would move code the compiler still holds indexes into, so the peephole pass does it.
+        std::unordered_map<std::size_t, std::size_t> far_jump_targets_;
+
         // When we need to patch previous bytecode with a jump distance, then use `Jump_backpatch` to
         // remember the position of the jump instruction and to apply the patch.
         class Jump_backpatch
         {
-            std::vector<std::uint8_t>& bytecode_;
+            Chunk& chunk_;
             const std::size_t jump_begin_index_;
 
           public:
             // At the moment of construction, the chunk's bytecode vector is expected to end with two dummy bytes.
             // The constructor will remember the position of those two dummy bytes.
-            Jump_backpatch(std::vector<std::uint8_t>& bytecode);
+            Jump_backpatch(Chunk& chunk);
 
             // Calculate the jump distance from the dummy bytes to the current end of the bytecode.
             // The dummy bytes will be patched with the distance calculated.
@@ -123,6 +176,14 @@ namespace motts::lox
         // A private helper to emit a raw byte.
         void emit(std::uint8_t, const Source_map_token&);
 
+        // Give the property opcode just emitted an inline cache of its own.
+        void add_inline_cache();
+
+        // Operands are one byte each, unless any of an opcode's operands is too big for that. Then a wide prefix
+        // before the opcode makes every one of its operands two bytes, and its jump distance four.
+        void emit_opcode(Opcode, bool wide, const Source_map_token&);
+        void emit_operand(std::size_t, bool wide, const Source_map_token&);
+
       public:
         // Read-only access.
         const auto& bytecode() const
@@ -135,20 +196,50 @@ namespace motts::lox
             return constants_;
         }
 
+        const auto& global_slot_indexes() const
+        {
+            return global_slot_indexes_;
+        }
+
         const auto& source_map_tokens() const
         {
             return source_map_tokens_;
         }
 
+        const auto& inline_cache_indexes() const
+        {
+            return inline_cache_indexes_;
+        }
+
+        // The VM fills these in as it runs, so they're writable even though the rest of the chunk isn't.
+        const auto& inline_caches() const
+        {
+            return inline_caches_;
+        }
+
+        auto& inline_caches()
+        {
+            return inline_caches_;
+        }
+
+        // After compaction, point every constant, source map lexeme, and inline cache at where its object moved to.
+        void update_refs(GC_heap&);
+
         // This template is for simple single-byte opcodes. The cpp file will instantiate the compatible opcodes.
         // Example usage: chunk.emit<Opcode::nil>(token); chunk.emit<Opcode::add>(token);
         template<Opcode>
         void emit(const Source_map_token&);
 
-        // This template is for the *_global/class/method/*_property opcodes. The cpp file will instantiate the compatible opcodes.
-        // Example usage: chunk.emit<Opcode::define_global>(global_name, token); chunk.emit<Opcode::get_property>(property_name, token);
+        // This template is for the class/method/*_property opcodes. The cpp file will instantiate the compatible opcodes.
+        // Example usage: chunk.emit<Opcode::class_>(class_name, token); chunk.emit<Opcode::get_property>(property_name, token);
         template<Opcode>
-        void emit(GC_ptr<const std::string> identifier_name, const Source_map_token&);
+        void emit(GC_ptr<const String> identifier_name, const Source_map_token&);
+
+        // This template is for the *_global opcodes. The cpp file will instantiate the compatible opcodes.
+        // The name is still stored as a constant for disassembly and error messages, but the VM uses only the slot.
+        // Example usage: chunk.emit<Opcode::define_global>(global_name, interned_strings.global_slot_index(global_name), token);
+        template<Opcode>
+        void emit(GC_ptr<const String> global_name, std::size_t global_slot_index, const Source_map_token&);
 
         // This template is for the *_local/*_upvalue opcodes. The cpp file will instantiate the compatible opcodes.
         // Example usage: chunk.emit<Opcode::get_local>(2, token); chunk.emit<Opcode::set_upvalue>(7, token);
@@ -156,6 +247,12 @@ namespace motts::lox
         void emit(unsigned int index, const Source_map_token&);
 
         void emit_call(unsigned int arg_count, const Source_map_token&);
+
+        // This template is for the invoke/super_invoke opcodes. The cpp file will instantiate the compatible opcodes.
+        // Example usage: chunk.emit_invoke<Opcode::invoke>(method_name, arg_count, token);
+        template<Opcode>
+        void emit_invoke(GC_ptr<const String> method_name, unsigned int arg_count, const Source_map_token&);
+
         void emit_closure(GC_ptr<Function>, const std::vector<Tracked_upvalue>&, const Source_map_token&);
         void emit_constant(Dynamic_type_value, const Source_map_token&);
 
@@ -174,6 +271,14 @@ namespace motts::lox
         Jump_backpatch emit_jump_if_false(const Source_map_token&);
 
         void emit_loop(unsigned int loop_begin_bytecode_index, const Source_map_token&);
+
+        // Rewrites common opcode sequences into fused opcodes, such as less then not into greater_equal,
+        // and `i = i + 1;` on a local into add_local_constant. The chunk must be complete, since this moves opcodes and re-aims jumps.
+        // This is also where jumps too far for 16 bits are widened, so every compiled chunk must go through it.
+        void optimize_peephole();
+
+        // Frees what only compiling needs, once the chunk is complete.
+        void end_compile();
     };
 
     std::ostream& operator<<(std::ostream&, const Chunk&);
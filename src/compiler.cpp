@@ -1,7 +1,9 @@
 #include "compiler.hpp"
 
 #include <cassert>
+#include <optional>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
@@ -66,6 +68,8 @@ namespace motts::lox
             while (token_iter != token_iter_end) {
                 compile_declaration();
             }
+            root_chunk.chunk.optimize_peephole();
+            root_chunk.chunk.end_compile();
 
             return std::move(root_chunk.chunk);
         }
@@ -88,7 +92,7 @@ namespace motts::lox
             const auto maybe_local_iter = std::find_if(
                 function_chunks.back()->tracked_locals.crbegin(),
                 function_chunks.back()->tracked_locals.crend(),
-                [&](const auto& tracked_local) { return tracked_local.name == *identifier_token.lexeme; }
+                [&](const auto& tracked_local) { return tracked_local.name == identifier_token.lexeme->chars(); }
             );
             if (maybe_local_iter != function_chunks.back()->tracked_locals.crend()) {
                 const auto local_iter = maybe_local_iter.base() - 1;
@@ -103,12 +107,13 @@ namespace motts::lox
                 const auto tracked_local_stack_index = local_iter - function_chunks.back()->tracked_locals.cbegin();
                 function_chunks.back()->chunk.emit<local_opcode>(tracked_local_stack_index, identifier_token);
             } else {
-                const auto maybe_upvalue_iter = track_upvalue(*identifier_token.lexeme);
+                const auto maybe_upvalue_iter = track_upvalue(identifier_token.lexeme->chars());
                 if (maybe_upvalue_iter != function_chunks.back()->tracked_upvalues.cend()) {
                     const auto tracked_upvalue_index = maybe_upvalue_iter - function_chunks.back()->tracked_upvalues.cbegin();
                     function_chunks.back()->chunk.emit<upvalue_opcode>(tracked_upvalue_index, identifier_token);
                 } else {
-                    function_chunks.back()->chunk.emit<global_opcode>(identifier_token.lexeme, identifier_token);
+                    const auto global_slot_index = interned_strings.global_slot_index(identifier_token.lexeme);
+                    function_chunks.back()->chunk.emit<global_opcode>(identifier_token.lexeme, global_slot_index, identifier_token);
                 }
             }
         }
@@ -151,7 +156,7 @@ namespace motts::lox
                 function_chunks.back()->tracked_locals.cbegin(),
                 function_chunks.back()->tracked_locals.cend(),
                 [&](const auto& tracked_local) {
-                    return tracked_local.depth == scope_depth && tracked_local.name == *identifier_token.lexeme;
+                    return tracked_local.depth == scope_depth && tracked_local.name == identifier_token.lexeme->chars();
                 }
             );
             if (maybe_redeclared_iter != function_chunks.back()->tracked_locals.cend()) {
@@ -161,7 +166,7 @@ namespace motts::lox
                 throw std::runtime_error{os.str()};
             }
 
-            function_chunks.back()->tracked_locals.push_back({*identifier_token.lexeme, scope_depth, initialized});
+            function_chunks.back()->tracked_locals.push_back({identifier_token.lexeme->chars(), scope_depth, initialized});
         }
 
         std::vector<Tracked_upvalue>::const_iterator track_upvalue(std::string_view identifier_name)
@@ -227,6 +232,272 @@ namespace motts::lox
             return function_chunks.back()->tracked_upvalues.cend();
         }
 
+        // Literals, and operators whose operands are all literals, are evaluated here at compile time.
+        // The fold functions read ahead without moving `token_iter` or emitting anything, and each mirrors the compile function
+        // of the same precedence. An expression isn't folded if it isn't constant, or if evaluating it would be a runtime error,
+        // which is left for the VM to raise as usual.
+        enum struct Precedence
+        {
+            or_,
+            and_,
+            equality,
+            comparison,
+            addition,
+            multiplication,
+            unary
+        };
+
+        struct Folded_expression
+        {
+            Dynamic_type_value value;
+
+            // Just past the expression's last token.
+            Token_iterator end;
+        };
+
+        static bool is_binary_operator(Token_type type, Precedence precedence)
+        {
+            switch (precedence) {
+                case Precedence::or_:
+                    return type == Token_type::or_;
+                case Precedence::and_:
+                    return type == Token_type::and_;
+                case Precedence::equality:
+                    return type == Token_type::equal_equal || type == Token_type::bang_equal;
+                case Precedence::comparison:
+                    return type == Token_type::less || type == Token_type::less_equal || type == Token_type::greater
+                           || type == Token_type::greater_equal;
+                case Precedence::addition:
+                    return type == Token_type::plus || type == Token_type::minus;
+                case Precedence::multiplication:
+                    return type == Token_type::star || type == Token_type::slash;
+                default:
+                    return false;
+            }
+        }
+
+        std::optional<Dynamic_type_value> fold_binary_operation(Token_type binary_operator, Dynamic_type_value lhs, Dynamic_type_value rhs)
+        {
+            switch (binary_operator) {
+                default:
+                    break;
+
+                case Token_type::and_:
+                    return visit_value(Is_truthy_visitor{}, lhs) ? rhs : lhs;
+
+                case Token_type::or_:
+                    return visit_value(Is_truthy_visitor{}, lhs) ? lhs : rhs;
+
+                case Token_type::equal_equal:
+                    return lhs == rhs;
+
+                case Token_type::bang_equal:
+                    return ! (lhs == rhs);
+
+                case Token_type::plus: {
+                    const auto maybe_string_lhs = try_as<GC_ptr<const String>>(lhs);
+                    const auto maybe_string_rhs = try_as<GC_ptr<const String>>(rhs);
+                    if (maybe_string_lhs && maybe_string_rhs) {
+                        return interned_strings.get((*maybe_string_lhs)->chars() + (*maybe_string_rhs)->chars());
+                    }
+
+                    break;
+                }
+            }
+
+            const auto maybe_double_lhs = try_as<double>(lhs);
+            const auto maybe_double_rhs = try_as<double>(rhs);
+            if (! maybe_double_lhs || ! maybe_double_rhs) {
+                return std::nullopt;
+            }
+
+            // The same arithmetic as the VM's opcodes, including the comparisons that it runs as a negated opposite comparison.
+            switch (binary_operator) {
+                default:
+                    return std::nullopt;
+                case Token_type::plus:
+                    return *maybe_double_lhs + *maybe_double_rhs;
+                case Token_type::minus:
+                    return *maybe_double_lhs - *maybe_double_rhs;
+                case Token_type::star:
+                    return *maybe_double_lhs * *maybe_double_rhs;
+                case Token_type::slash:
+                    return *maybe_double_lhs / *maybe_double_rhs;
+                case Token_type::less:
+                    return *maybe_double_lhs < *maybe_double_rhs;
+                case Token_type::less_equal:
+                    return ! (*maybe_double_lhs > *maybe_double_rhs);
+                case Token_type::greater:
+                    return *maybe_double_lhs > *maybe_double_rhs;
+                case Token_type::greater_equal:
+                    return ! (*maybe_double_lhs < *maybe_double_rhs);
+            }
+        }
+
+        std::optional<Folded_expression> fold_primary_expression(Token_iterator iter)
+        {
+            std::optional<Folded_expression> folded;
+            switch (iter->type) {
+                default:
+                    return std::nullopt;
+
+                case Token_type::false_:
+                    folded = {false, ++iter};
+                    break;
+
+                case Token_type::nil:
+                    folded = {nullptr, ++iter};
+                    break;
+
+                case Token_type::number:
+                    folded = {boost::lexical_cast<double>(iter->lexeme), ++iter};
+                    break;
+
+                case Token_type::string: {
+                    const std::string_view quote_marks_trimmed{iter->lexeme.cbegin() + 1, iter->lexeme.cend() - 1};
+                    folded = {interned_strings.get(quote_marks_trimmed), ++iter};
+                    break;
+                }
+
+                case Token_type::true_:
+                    folded = {true, ++iter};
+                    break;
+
+                case Token_type::left_paren: {
+                    folded = fold_expression(++iter, Precedence::or_);
+                    if (! folded || folded->end->type != Token_type::right_paren) {
+                        return std::nullopt;
+                    }
+                    ++folded->end;
+
+                    break;
+                }
+            }
+
+            // Calling a literal or getting its property is a runtime error.
+            if (folded->end->type == Token_type::left_paren || folded->end->type == Token_type::dot) {
+                return std::nullopt;
+            }
+
+            return folded;
+        }
+
+        std::optional<Folded_expression> fold_unary_expression(Token_iterator iter)
+        {
+            if (iter->type != Token_type::minus && iter->type != Token_type::bang) {
+                return fold_primary_expression(iter);
+            }
+
+            const auto unary_operator = iter->type;
+            auto folded = fold_unary_expression(++iter);
+            if (! folded) {
+                return std::nullopt;
+            }
+
+            if (unary_operator == Token_type::bang) {
+                folded->value = ! visit_value(Is_truthy_visitor{}, folded->value);
+            } else if (const auto maybe_double = try_as<double>(folded->value)) {
+                folded->value = -*maybe_double;
+            } else {
+                return std::nullopt;
+            }
+
+            return folded;
+        }
+
+        std::optional<Folded_expression> fold_expression(Token_iterator iter, Precedence precedence)
+        {
+            if (precedence == Precedence::unary) {
+                return fold_unary_expression(iter);
+            }
+
+            const auto operand_precedence = static_cast<Precedence>(static_cast<int>(precedence) + 1);
+            auto folded = fold_expression(iter, operand_precedence);
+            while (folded && is_binary_operator(folded->end->type, precedence)) {
+                const auto binary_operator = folded->end->type;
+                const auto folded_rhs = fold_expression(++folded->end, operand_precedence);
+                const auto maybe_value =
+                    folded_rhs ? fold_binary_operation(binary_operator, folded->value, folded_rhs->value) : std::nullopt;
+                if (! maybe_value) {
+                    return std::nullopt;
+                }
+
+                folded = {*maybe_value, folded_rhs->end};
+            }
+
+            return folded;
+        }
+
+        void emit_folded_value(Dynamic_type_value value, const Source_map_token& token)
+        {
+            if (try_as<std::nullptr_t>(value)) {
+                function_chunks.back()->chunk.emit<Opcode::nil>(token);
+            } else if (const auto maybe_bool = try_as<bool>(value)) {
+                if (*maybe_bool) {
+                    function_chunks.back()->chunk.emit<Opcode::true_>(token);
+                } else {
+                    function_chunks.back()->chunk.emit<Opcode::false_>(token);
+                }
+            } else {
+                function_chunks.back()->chunk.emit_constant(value, token);
+            }
+        }
+
+        // If the expression at this precedence begins with operands that fold together, such as the `1 + 2` of `1 + 2 + x`,
+        // then emits their value and returns true. The caller goes on to compile any remaining operators as usual.
+        bool compile_folded_prefix(Precedence precedence)
+        {
+            const auto operand_precedence =
+                precedence == Precedence::unary ? Precedence::unary : static_cast<Precedence>(static_cast<int>(precedence) + 1);
+            auto folded = fold_expression(token_iter, operand_precedence);
+            if (! folded) {
+                return false;
+            }
+
+            while (is_binary_operator(folded->end->type, precedence)) {
+                const auto binary_operator = folded->end->type;
+                auto rhs_iter = folded->end;
+                const auto folded_rhs = fold_expression(++rhs_iter, operand_precedence);
+                const auto maybe_value =
+                    folded_rhs ? fold_binary_operation(binary_operator, folded->value, folded_rhs->value) : std::nullopt;
+                if (! maybe_value) {
+                    break;
+                }
+
+                folded = {*maybe_value, folded_rhs->end};
+            }
+
+            emit_folded_value(folded->value, source_map_token(*token_iter));
+            token_iter = folded->end;
+
+            return true;
+        }
+
+        // Returns the truthiness of a condition that folds to a constant and ends right before `end_type`, and moves past it.
+        // Returns nothing and moves nowhere if the condition must be compiled.
+        std::optional<bool> fold_condition(Token_type end_type)
+        {
+            const auto folded = fold_expression(token_iter, Precedence::or_);
+            if (! folded || folded->end->type != end_type) {
+                return std::nullopt;
+            }
+
+            token_iter = folded->end;
+            return visit_value(Is_truthy_visitor{}, folded->value);
+        }
+
+        // Code that can never run, such as the else branch of `if (true)`, is still compiled so that its errors are reported,
+        // but into a scratch chunk that's then thrown away.
+        template<typename Compile_fn>
+        void compile_dead_code(Compile_fn compile_fn)
+        {
+            Chunk dead_chunk;
+            std::swap(function_chunks.back()->chunk, dead_chunk);
+            const auto _ = gsl::finally([&] { std::swap(function_chunks.back()->chunk, dead_chunk); });
+
+            compile_fn();
+        }
+
         void compile_primary_expression()
         {
             switch (token_iter->type) {
@@ -301,12 +572,20 @@ namespace motts::lox
                     const auto super_token = source_map_token(*token_iter++);
 
                     emit_getter(source_map_token(Token{Token_type::this_, "this", super_token.line}));
-                    emit_getter(super_token);
 
                     ensure_token_is(*token_iter++, Token_type::dot);
                     ensure_token_is(*token_iter, Token_type::identifier);
                     const auto method_name_token = source_map_token(*token_iter++);
-                    function_chunks.back()->chunk.emit<Opcode::get_super>(method_name_token.lexeme, method_name_token);
+
+                    // Calling a super method right away skips creating a bound method. The arguments go between "this" and the superclass.
+                    if (advance_if_match(Token_type::left_paren)) {
+                        const auto arg_count = compile_arguments();
+                        emit_getter(super_token);
+                        function_chunks.back()->chunk.emit_invoke<Opcode::super_invoke>(method_name_token.lexeme, arg_count, super_token);
+                    } else {
+                        emit_getter(super_token);
+                        function_chunks.back()->chunk.emit<Opcode::get_super>(method_name_token.lexeme, method_name_token);
+                    }
 
                     break;
                 }
@@ -318,6 +597,21 @@ namespace motts::lox
             }
         }
 
+        // Expects the left paren to already be consumed. Returns the number of arguments compiled.
+        unsigned int compile_arguments()
+        {
+            auto arg_count = 0u;
+            if (! advance_if_match(Token_type::right_paren)) {
+                do {
+                    compile_assignment_precedence_expression();
+                    ++arg_count;
+                } while (advance_if_match(Token_type::comma));
+                ensure_token_is(*token_iter++, Token_type::right_paren);
+            }
+
+            return arg_count;
+        }
+
         void compile_call_precedence_expression()
         {
             auto callee_token = source_map_token(*token_iter);
@@ -326,21 +620,23 @@ namespace motts::lox
 
             while (token_iter->type == Token_type::left_paren || token_iter->type == Token_type::dot) {
                 if (advance_if_match(Token_type::left_paren)) {
-                    auto arg_count = 0;
-                    if (! advance_if_match(Token_type::right_paren)) {
-                        do {
-                            compile_assignment_precedence_expression();
-                            ++arg_count;
-                        } while (advance_if_match(Token_type::comma));
-                        ensure_token_is(*token_iter++, Token_type::right_paren);
-                    }
+                    const auto arg_count = compile_arguments();
                     function_chunks.back()->chunk.emit_call(arg_count, callee_token);
                 }
 
                 if (advance_if_match(Token_type::dot)) {
                     ensure_token_is(*token_iter, Token_type::identifier);
                     const auto property_name_token = source_map_token(*token_iter++);
-                    function_chunks.back()->chunk.emit<Opcode::get_property>(property_name_token.lexeme, property_name_token);
+
+                    // A property get followed immediately by a call is fused into one invoke, which skips creating a bound method.
+                    if (advance_if_match(Token_type::left_paren)) {
+                        const auto arg_count = compile_arguments();
+                        function_chunks.back()->chunk.emit_invoke<Opcode::invoke>(
+                            property_name_token.lexeme, arg_count, property_name_token
+                        );
+                    } else {
+                        function_chunks.back()->chunk.emit<Opcode::get_property>(property_name_token.lexeme, property_name_token);
+                    }
                     callee_token = property_name_token;
                 }
             }
@@ -348,6 +644,10 @@ namespace motts::lox
 
         void compile_unary_precedence_expression()
         {
+            if (compile_folded_prefix(Precedence::unary)) {
+                return;
+            }
+
             if (token_iter->type == Token_type::minus || token_iter->type == Token_type::bang) {
                 const auto unary_op_scanner_token = *token_iter++;
                 const auto unary_op_source_map_token = source_map_token(unary_op_scanner_token);
@@ -377,7 +677,9 @@ namespace motts::lox
         void compile_multiplication_precedence_expression()
         {
             // Left expression.
-            compile_unary_precedence_expression();
+            if (! compile_folded_prefix(Precedence::multiplication)) {
+                compile_unary_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::star || token_iter->type == Token_type::slash) {
                 const auto binary_op_scanner_token = *token_iter++;
@@ -404,7 +706,9 @@ namespace motts::lox
         void compile_addition_precedence_expression()
         {
             // Left expression.
-            compile_multiplication_precedence_expression();
+            if (! compile_folded_prefix(Precedence::addition)) {
+                compile_multiplication_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::plus || token_iter->type == Token_type::minus) {
                 const auto binary_op_scanner_token = *token_iter++;
@@ -431,7 +735,9 @@ namespace motts::lox
         void compile_comparison_precedence_expression()
         {
             // Left expression.
-            compile_addition_precedence_expression();
+            if (! compile_folded_prefix(Precedence::comparison)) {
+                compile_addition_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::less || token_iter->type == Token_type::less_equal
                    || token_iter->type == Token_type::greater || token_iter->type == Token_type::greater_equal)
@@ -472,7 +778,9 @@ namespace motts::lox
         void compile_equality_precedence_expression()
         {
             // Left expression.
-            compile_comparison_precedence_expression();
+            if (! compile_folded_prefix(Precedence::equality)) {
+                compile_comparison_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::equal_equal || token_iter->type == Token_type::bang_equal) {
                 const auto equality_scanner_token = *token_iter++;
@@ -501,7 +809,9 @@ namespace motts::lox
         void compile_and_precedence_expression()
         {
             // Left expression.
-            compile_equality_precedence_expression();
+            if (! compile_folded_prefix(Precedence::and_)) {
+                compile_equality_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::and_) {
                 const auto and_token = source_map_token(*token_iter++);
@@ -520,7 +830,9 @@ namespace motts::lox
         void compile_or_precedence_expression()
         {
             // Left expression.
-            compile_and_precedence_expression();
+            if (! compile_folded_prefix(Precedence::or_)) {
+                compile_and_precedence_expression();
+            }
 
             while (token_iter->type == Token_type::or_) {
                 const auto or_token = source_map_token(*token_iter++);
@@ -633,10 +945,43 @@ namespace motts::lox
                 function_chunks.back()->chunk.emit<Opcode::nil>(fun_source_map_token);
             }
             function_chunks.back()->chunk.emit<Opcode::return_>(fun_source_map_token);
+            function_chunks.back()->chunk.optimize_peephole();
+            function_chunks.back()->chunk.end_compile();
 
             return param_count;
         }
 
+        // The rest of a for loop, after the semicolon of a condition that's constant and so is never tested.
+        void compile_constant_condition_for_rest(bool constant_condition, const Source_map_token& for_token)
+        {
+            const auto compile_increment_and_body = [&] {
+                if (advance_if_match(Token_type::right_paren)) {
+                    const auto body_begin_bytecode_index = function_chunks.back()->chunk.bytecode().size();
+                    compile_statement();
+                    function_chunks.back()->chunk.emit_loop(body_begin_bytecode_index, for_token);
+
+                    return;
+                }
+
+                // The first pass through the loop skips the increment.
+                auto to_body_jump_backpatch = function_chunks.back()->chunk.emit_jump(for_token);
+                const auto increment_begin_bytecode_index = function_chunks.back()->chunk.bytecode().size();
+                compile_assignment_precedence_expression();
+                function_chunks.back()->chunk.emit<Opcode::pop>(for_token);
+                ensure_token_is(*token_iter++, Token_type::right_paren);
+
+                to_body_jump_backpatch.to_next_opcode();
+                compile_statement();
+                function_chunks.back()->chunk.emit_loop(increment_begin_bytecode_index, for_token);
+            };
+
+            if (constant_condition) {
+                compile_increment_and_body();
+            } else {
+                compile_dead_code(compile_increment_and_body);
+            }
+        }
+
         void compile_statement()
         {
             switch (token_iter->type) {
@@ -649,6 +994,28 @@ namespace motts::lox
                     const auto if_token = source_map_token(*token_iter++);
 
                     ensure_token_is(*token_iter++, Token_type::left_paren);
+
+                    // A constant condition picks its branch now, and the other branch is dead.
+                    if (const auto maybe_constant_condition = fold_condition(Token_type::right_paren)) {
+                        ++token_iter;
+
+                        if (*maybe_constant_condition) {
+                            compile_statement();
+                        } else {
+                            compile_dead_code([&] { compile_statement(); });
+                        }
+
+                        if (advance_if_match(Token_type::else_)) {
+                            if (*maybe_constant_condition) {
+                                compile_dead_code([&] { compile_statement(); });
+                            } else {
+                                compile_statement();
+                            }
+                        }
+
+                        break;
+                    }
+
                     compile_assignment_precedence_expression();
                     ensure_token_is(*token_iter++, Token_type::right_paren);
 
@@ -681,13 +1048,22 @@ namespace motts::lox
                         }
                     }
 
+                    // A blank condition is the same as a constant true condition.
                     const auto condition_begin_bytecode_index = function_chunks.back()->chunk.bytecode().size();
-                    if (advance_if_match(Token_type::semicolon)) {
-                        function_chunks.back()->chunk.emit<Opcode::true_>(for_token);
-                    } else {
+                    const auto maybe_constant_condition =
+                        token_iter->type == Token_type::semicolon ? std::optional<bool>{true} : fold_condition(Token_type::semicolon);
+                    if (! maybe_constant_condition) {
                         compile_assignment_precedence_expression();
-                        ensure_token_is(*token_iter++, Token_type::semicolon);
                     }
+                    ensure_token_is(*token_iter++, Token_type::semicolon);
+
+                    if (maybe_constant_condition) {
+                        compile_constant_condition_for_rest(*maybe_constant_condition, for_token);
+                        pop_top_scope_depth(for_token);
+
+                        break;
+                    }
+
                     auto to_end_jump_backpatch = function_chunks.back()->chunk.emit_jump_if_false(for_token);
                     auto to_body_jump_backpatch = function_chunks.back()->chunk.emit_jump(for_token);
 
@@ -772,6 +1148,21 @@ namespace motts::lox
                     const auto loop_begin_bytecode_index = function_chunks.back()->chunk.bytecode().size();
 
                     ensure_token_is(*token_iter++, Token_type::left_paren);
+
+                    // A constant condition is never tested. The loop either runs forever or never runs.
+                    if (const auto maybe_constant_condition = fold_condition(Token_type::right_paren)) {
+                        ++token_iter;
+
+                        if (*maybe_constant_condition) {
+                            compile_statement();
+                            function_chunks.back()->chunk.emit_loop(loop_begin_bytecode_index, while_token);
+                        } else {
+                            compile_dead_code([&] { compile_statement(); });
+                        }
+
+                        break;
+                    }
+
                     compile_assignment_precedence_expression();
                     ensure_token_is(*token_iter++, Token_type::right_paren);
                     auto to_end_jump_backpatch = function_chunks.back()->chunk.emit_jump_if_false(while_token);
@@ -856,7 +1247,7 @@ namespace motts::lox
                             --scope_depth;
                             function_chunks.pop_back();
                         });
-                        if (*method_name_token.lexeme == "init") {
+                        if (method_name_token.lexeme->chars() == "init") {
                             function_chunk.is_class_init_method = true;
                         }
 
@@ -878,7 +1269,8 @@ namespace motts::lox
                     }
 
                     if (scope_depth == 0) {
-                        function_chunks.back()->chunk.emit<Opcode::define_global>(class_name_token.lexeme, class_token);
+                        const auto global_slot_index = interned_strings.global_slot_index(class_name_token.lexeme);
+                        function_chunks.back()->chunk.emit<Opcode::define_global>(class_name_token.lexeme, global_slot_index, class_token);
                     }
 
                     break;
@@ -910,7 +1302,8 @@ namespace motts::lox
                     }
 
                     if (scope_depth == 0) {
-                        function_chunks.back()->chunk.emit<Opcode::define_global>(fun_name_token.lexeme, fun_token);
+                        const auto global_slot_index = interned_strings.global_slot_index(fun_name_token.lexeme);
+                        function_chunks.back()->chunk.emit<Opcode::define_global>(fun_name_token.lexeme, global_slot_index, fun_token);
                     } else {
                         track_local(fun_name_token);
                     }
@@ -935,7 +1328,8 @@ namespace motts::lox
                     ensure_token_is(*token_iter++, Token_type::semicolon);
 
                     if (scope_depth == 0) {
-                        function_chunks.back()->chunk.emit<Opcode::define_global>(variable_name_token.lexeme, var_token);
+                        const auto global_slot_index = interned_strings.global_slot_index(variable_name_token.lexeme);
+                        function_chunks.back()->chunk.emit<Opcode::define_global>(variable_name_token.lexeme, global_slot_index, var_token);
                     } else {
                         function_chunks.back()->tracked_locals.back().initialized = true;
                     }
@@ -1,56 +1,208 @@
 #include "interned_strings.hpp"
 
+#include <utility>
+
+#include "object.hpp"
+
 namespace motts::lox
 {
+    namespace
+    {
+        constexpr std::size_t min_n_slots{64};
+    }
+
     Interned_strings::Interned_strings(GC_heap& gc_heap)
-        : gc_heap_{gc_heap}
+        : gc_heap_{gc_heap},
+          slots_(min_n_slots)
     {
-        gc_heap_.on_destroy_ptr.push_back([this](const auto& control_block) {
-            const auto maybe_gc_str_iter = strings_by_ptr_.find(&control_block);
-            if (maybe_gc_str_iter != strings_by_ptr_.cend()) {
-                strings_by_chars_.erase(*maybe_gc_str_iter->second);
-                strings_by_ptr_.erase(maybe_gc_str_iter);
+        gc_heap_.on_mark_roots.push_back([this] {
+            for (const auto& global_name : global_names_) {
+                mark(gc_heap_, global_name);
             }
         });
+
+        // Slots are placed by hash, which doesn't change when a string moves, so only the map keyed by address is rebuilt.
+        gc_heap_.on_update_roots.push_back([this] {
+            for (auto& global_name : global_names_) {
+                update_ref(gc_heap_, global_name);
+            }
+
+            decltype(global_slot_indexes_) global_slot_indexes;
+            for (const auto& [global_name, slot_index] : global_slot_indexes_) {
+                global_slot_indexes.emplace(forwarded(gc_heap_, global_name), slot_index);
+            }
+            global_slot_indexes_ = std::move(global_slot_indexes);
+
+            for (auto& slot : slots_) {
+                if (slot) {
+                    update_ref(gc_heap_, slot);
+                }
+            }
+
+            for (auto& new_string : new_strings_) {
+                update_ref(gc_heap_, new_string);
+            }
+        });
+
+        gc_heap_.on_clear_weak_refs.push_back([this] { clear_weak_refs(); });
     }
 
     Interned_strings::~Interned_strings()
     {
-        gc_heap_.on_destroy_ptr.pop_back();
+        gc_heap_.on_clear_weak_refs.pop_back();
+        gc_heap_.on_update_roots.pop_back();
+        gc_heap_.on_mark_roots.pop_back();
+    }
+
+    std::size_t Interned_strings::find_slot(std::string_view chars, std::size_t hash) const
+    {
+        const auto slot_mask = slots_.size() - 1;
+        for (auto slot_index = hash & slot_mask;; slot_index = (slot_index + 1) & slot_mask) {
+            const auto slot = slots_[slot_index];
+            if (! slot || (slot->hash() == hash && slot->chars() == chars)) {
+                return slot_index;
+            }
+        }
+    }
+
+    GC_ptr<const String> Interned_strings::insert(GC_ptr<const String> gc_str)
+    {
+        // Keep at most half the slots full, so that probe sequences stay short.
+        if ((n_strings_ + 1) * 2 > slots_.size()) {
+            rehash(slots_.size() * 2);
+        }
+
+        slots_[find_slot(gc_str->chars(), gc_str->hash())] = gc_str;
+        ++n_strings_;
+        new_strings_.push_back(gc_str);
+
+        return gc_str;
+    }
+
+    void Interned_strings::erase(GC_ptr<const String> gc_str)
+    {
+        const auto slot_mask = slots_.size() - 1;
+        auto empty_index = gc_str->hash() & slot_mask;
+        while (slots_[empty_index] != gc_str) {
+            empty_index = (empty_index + 1) & slot_mask;
+        }
+
+        // Rather than leave a tombstone, shift back any later string whose probe sequence would pass through the emptied slot.
+        for (auto slot_index = (empty_index + 1) & slot_mask; slots_[slot_index]; slot_index = (slot_index + 1) & slot_mask) {
+            const auto home_index = slots_[slot_index]->hash() & slot_mask;
+            const auto home_is_after_empty = empty_index <= slot_index ? (empty_index < home_index && home_index <= slot_index)
+                                                                       : (empty_index < home_index || home_index <= slot_index);
+            if (! home_is_after_empty) {
+                slots_[empty_index] = slots_[slot_index];
+                empty_index = slot_index;
+            }
+        }
+
+        slots_[empty_index] = {};
+        --n_strings_;
+    }
+
+    void Interned_strings::rehash(std::size_t n_slots)
+    {
+        auto old_slots = std::exchange(slots_, std::vector<GC_ptr<const String>>(n_slots));
+        for (const auto slot : old_slots) {
+            if (slot) {
+                slots_[find_slot(slot->chars(), slot->hash())] = slot;
+            }
+        }
     }
 
-    GC_ptr<const std::string> Interned_strings::get(const char* str)
+    void Interned_strings::clear_weak_refs()
+    {
+        // Only strings interned since the last marking can be young, so a young collection needn't look at the rest.
+        if (gc_heap_.collecting_young_only()) {
+            for (const auto new_string : new_strings_) {
+                if (! gc_heap_.survives(*new_string.control_block)) {
+                    erase(new_string);
+                }
+            }
+        } else {
+            for (auto& slot : slots_) {
+                if (slot && ! gc_heap_.survives(*slot.control_block)) {
+                    slot = {};
+                    --n_strings_;
+                }
+            }
+
+            // Emptied slots break the probe sequences that pass through them, so the survivors are placed again,
+            // in a table sized for however many there are now.
+            auto n_slots = min_n_slots;
+            while (n_strings_ * 2 > n_slots) {
+                n_slots *= 2;
+            }
+            rehash(n_slots);
+        }
+
+        new_strings_.clear();
+    }
+
+    GC_ptr<const String> Interned_strings::get(const char* str)
     {
         return get(std::string_view{str});
     }
 
-    GC_ptr<const std::string> Interned_strings::get(std::string_view str)
+    GC_ptr<const String> Interned_strings::get(std::string_view str)
     {
-        const auto maybe_dup_iter = strings_by_chars_.find(str);
-        if (maybe_dup_iter != strings_by_chars_.cend()) {
-            return maybe_dup_iter->second;
+        const auto hash = String::hash_chars(str);
+        if (const auto maybe_dup = slots_[find_slot(str, hash)]) {
+            return maybe_dup;
         }
 
-        const auto gc_str = gc_heap_.make<const std::string>({str.cbegin(), str.cend()});
+        return insert(gc_heap_.make<const String>({std::string{str}, hash}));
+    }
 
-        strings_by_chars_[*gc_str] = gc_str;
-        strings_by_ptr_[gc_str.control_block] = gc_str;
+    GC_ptr<const String> Interned_strings::get(std::string&& str)
+    {
+        const auto hash = String::hash_chars(str);
+        if (const auto maybe_dup = slots_[find_slot(str, hash)]) {
+            return maybe_dup;
+        }
 
-        return gc_str;
+        return insert(gc_heap_.make<const String>({std::move(str), hash}));
     }
 
-    GC_ptr<const std::string> Interned_strings::get(std::string&& str)
+    GC_ptr<const String> Interned_strings::intern(GC_ptr<const String> gc_str)
     {
-        const auto maybe_dup_iter = strings_by_chars_.find(str);
-        if (maybe_dup_iter != strings_by_chars_.cend()) {
-            return maybe_dup_iter->second;
+        if (gc_str->interned_) {
+            return gc_str;
+        }
+
+        if (gc_str->canonical_) {
+            return gc_str->canonical_;
         }
 
-        const auto gc_str = gc_heap_.make<const std::string>(std::move(str));
+        const auto& chars = gc_str->chars();
+        const auto hash = String::hash_chars(chars);
+        if (const auto maybe_dup = slots_[find_slot(chars, hash)]) {
+            write_barrier(gc_heap_, gc_str);
+            gc_str->canonical_ = maybe_dup;
+
+            return maybe_dup;
+        }
 
-        strings_by_chars_[*gc_str] = gc_str;
-        strings_by_ptr_[gc_str.control_block] = gc_str;
+        gc_str->hash_ = hash;
+        gc_str->interned_ = true;
 
-        return gc_str;
+        return insert(gc_str);
+    }
+
+    std::size_t Interned_strings::global_slot_index(GC_ptr<const String> global_name)
+    {
+        const auto [slot_index_iter, inserted] = global_slot_indexes_.try_emplace(global_name, global_names_.size());
+        if (inserted) {
+            global_names_.push_back(global_name);
+        }
+
+        return slot_index_iter->second;
+    }
+
+    std::size_t Interned_strings::n_global_slots() const
+    {
+        return global_names_.size();
     }
 }
@@ -3,23 +3,52 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "memory.hpp"
+#include "object-fwd.hpp"
 
 namespace motts::lox
 {
     class Interned_strings
     {
         GC_heap& gc_heap_;
-        std::unordered_map<std::string_view, GC_ptr<const std::string>> strings_by_chars_;
-        std::unordered_map<const GC_control_block_base*, GC_ptr<const std::string>> strings_by_ptr_;
+
+        // A weak set, open addressed with linear probing, where a null slot is empty. Strings that don't survive a collection
+        // are forgotten right after marking. Each string caches its hash, so growing never rehashes characters, and a slot
+        // depends only on the characters, so compaction can move strings without moving slots.
+        std::vector<GC_ptr<const String>> slots_;
+        std::size_t n_strings_{0};
+
+        // Strings interned since the last marking, which are all a young collection needs to check.
+        std::vector<GC_ptr<const String>> new_strings_;
+
+        // The compiler and the VM share these strings, so this is also where global names get their slots.
+        std::unordered_map<GC_ptr<const String>, std::size_t> global_slot_indexes_;
+        std::vector<GC_ptr<const String>> global_names_;
+
+        // The slot that holds a string with these characters, or else the empty slot that ends its probe sequence.
+        std::size_t find_slot(std::string_view chars, std::size_t hash) const;
+
+        GC_ptr<const String> insert(GC_ptr<const String>);
+        void erase(GC_ptr<const String>);
+        void rehash(std::size_t n_slots);
+        void clear_weak_refs();
 
       public:
         Interned_strings(GC_heap&);
         ~Interned_strings();
 
-        GC_ptr<const std::string> get(const char*);
-        GC_ptr<const std::string> get(std::string_view);
-        GC_ptr<const std::string> get(std::string&&);
+        GC_ptr<const String> get(const char*);
+        GC_ptr<const String> get(std::string_view);
+        GC_ptr<const String> get(std::string&&);
+
+        // The interned string equal to this one. A rope becomes the interned string itself, unless an equal string was interned first.
+        GC_ptr<const String> intern(GC_ptr<const String>);
+
+        // Each distinct global name gets the next free slot the first time it's asked for, and keeps that slot for good.
+        // The names are kept alive, so a name can't be collected and come back with a different slot.
+        std::size_t global_slot_index(GC_ptr<const String> global_name);
+        std::size_t n_global_slots() const;
     };
 }
@@ -9,11 +9,23 @@
 
 namespace motts::lox
 {
-    Lox::Lox(std::ostream& cout_arg, std::ostream& cerr_arg, std::istream& cin_arg, bool debug_arg)
+    Lox::Lox(
+        std::ostream& cout_arg,
+        std::ostream& cerr_arg,
+        std::istream& cin_arg,
+        bool debug_arg,
+        double gc_growth_factor,
+        std::size_t gc_min_heap_size,
+        std::size_t gc_mark_slice_budget,
+        std::size_t gc_n_mark_threads,
+        double gc_compact_threshold,
+        std::size_t gc_max_heap_size
+    )
         : debug{debug_arg},
           cout{cout_arg},
           cerr{cerr_arg},
-          cin{cin_arg}
+          cin{cin_arg},
+          gc_heap{gc_growth_factor, gc_min_heap_size, gc_mark_slice_budget, gc_n_mark_threads, gc_compact_threshold, gc_max_heap_size}
     {
     }
 
@@ -49,6 +61,11 @@ namespace motts::lox
                 // If the user makes a mistake, it shouldn't kill their entire session.
                 lox.cerr << error.what() << '\n';
             }
+
+            // No Lox code is running between lines, so objects can move.
+            if (lox.gc_heap.compaction_due()) {
+                lox.gc_heap.compact();
+            }
         }
     }
 }
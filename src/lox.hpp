@@ -21,7 +21,7 @@ namespace motts::lox
         std::ostream& cerr;
         std::istream& cin;
 
-        // Tracks allocations, and frees using mark-and-sweep.
+        // Tracks allocations, and frees using generational mark-and-sweep. The REPL compacts it between lines.
         GC_heap gc_heap;
 
         // Dedup string allocations
@@ -30,7 +30,18 @@ namespace motts::lox
         // Keeps globals and a stack, and executes bytecode.
         VM vm{gc_heap, interned_strings, cout, debug};
 
-        Lox(std::ostream& cout = std::cout, std::ostream& cerr = std::cerr, std::istream& cin = std::cin, bool debug = false);
+        Lox(
+            std::ostream& cout = std::cout,
+            std::ostream& cerr = std::cerr,
+            std::istream& cin = std::cin,
+            bool debug = false,
+            double gc_growth_factor = GC_heap::default_growth_factor,
+            std::size_t gc_min_heap_size = GC_heap::default_min_heap_size,
+            std::size_t gc_mark_slice_budget = GC_heap::default_mark_slice_budget,
+            std::size_t gc_n_mark_threads = GC_heap::default_n_mark_threads,
+            double gc_compact_threshold = GC_heap::default_compact_threshold,
+            std::size_t gc_max_heap_size = GC_heap::default_max_heap_size
+        );
     };
 
     void run_file(Lox&, const std::string& file_path);
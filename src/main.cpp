@@ -15,7 +15,21 @@ int main(int argc, const char* argv[])
     options.add_options()
         ("help", "Show this help message.")
         ("input-file", boost::program_options::value<std::string>(), "Lox script file to run.")
-        ("debug", "Disassemble instructions and dump the stack.");
+        ("debug", "Disassemble instructions and dump the stack.")
+        ("ic-stats", "Print inline cache hit and miss counts after the script runs.")
+        ("gc-stats", "Print garbage collector stats as JSON after the script runs.")
+        ("gc-growth-factor", boost::program_options::value<double>()->default_value(motts::lox::GC_heap::default_growth_factor),
+            "How much the heap may grow after a full garbage collection before the next one.")
+        ("gc-min-heap", boost::program_options::value<std::size_t>()->default_value(motts::lox::GC_heap::default_min_heap_size),
+            "Heap size in bytes below which no full garbage collection runs.")
+        ("gc-mark-slice", boost::program_options::value<std::size_t>()->default_value(motts::lox::GC_heap::default_mark_slice_budget),
+            "Objects to mark per slice of an incremental full garbage collection, or 0 to mark all at once.")
+        ("gc-mark-threads", boost::program_options::value<std::size_t>()->default_value(motts::lox::GC_heap::default_n_mark_threads),
+            "Threads that mark in parallel when a collection marks all at once.")
+        ("gc-compact-threshold", boost::program_options::value<double>()->default_value(motts::lox::GC_heap::default_compact_threshold),
+            "Fraction of the heap's reserved memory that may be free before the REPL compacts it between lines, or 0 to never compact.")
+        ("gc-max-heap", boost::program_options::value<std::size_t>()->default_value(motts::lox::GC_heap::default_max_heap_size),
+            "Heap size in bytes beyond which the script fails with an out of memory error, or 0 for no limit.");
     // clang-format on
 
     boost::program_options::positional_options_description positional_options;
@@ -39,10 +53,29 @@ int main(int argc, const char* argv[])
     }
 
     try {
-        motts::lox::Lox lox{std::cout, std::cerr, std::cin, options_map.contains("debug")};
+        motts::lox::Lox lox{
+            std::cout,
+            std::cerr,
+            std::cin,
+            options_map.contains("debug"),
+            options_map["gc-growth-factor"].as<double>(),
+            options_map["gc-min-heap"].as<std::size_t>(),
+            options_map["gc-mark-slice"].as<std::size_t>(),
+            options_map["gc-mark-threads"].as<std::size_t>(),
+            options_map["gc-compact-threshold"].as<double>(),
+            options_map["gc-max-heap"].as<std::size_t>()
+        };
 
         if (options_map.contains("input-file")) {
             run_file(lox, options_map["input-file"].as<std::string>());
+
+            if (options_map.contains("ic-stats")) {
+                std::cerr << lox.vm.inline_cache_stats();
+            }
+
+            if (options_map.contains("gc-stats")) {
+                print_json(std::cerr, lox.gc_heap.stats());
+            }
         } else {
             run_prompt(lox);
         }
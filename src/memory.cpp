@@ -1,52 +1,799 @@
 #include "memory.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <boost/core/demangle.hpp>
 
 namespace motts::lox
 {
+    namespace
+    {
+        // Which of the parallel marker's gray stacks belongs to this thread. The collecting thread always uses the first.
+        thread_local std::size_t gray_stack_index{0};
+    }
+
+    // Marks on several threads at once. Each thread traces from its own gray stack, and when that runs out,
+    // it steals half of another thread's stack. Helper threads live as long as the marker and wait between collections.
+    class Parallel_marker
+    {
+        struct Gray_stack
+        {
+            std::mutex mutex;
+            std::vector<GC_control_block_base*> control_blocks;
+        };
+
+        GC_heap& gc_heap_;
+        std::vector<Gray_stack> gray_stacks_;
+
+        // Only threads with work can make more work, so marking is done when no thread is busy.
+        std::atomic<std::size_t> n_busy_{0};
+
+        std::mutex round_mutex_;
+        std::condition_variable round_start_;
+        std::condition_variable round_end_;
+        std::size_t round_{0};
+        std::size_t n_helpers_finished_{0};
+        bool stopping_{false};
+
+        std::vector<std::thread> helper_threads_;
+
+        GC_control_block_base* pop(Gray_stack& gray_stack)
+        {
+            const std::lock_guard lock{gray_stack.mutex};
+            if (gray_stack.control_blocks.empty()) {
+                return nullptr;
+            }
+
+            auto* control_block = gray_stack.control_blocks.back();
+            gray_stack.control_blocks.pop_back();
+            return control_block;
+        }
+
+        bool steal(std::size_t thief_index)
+        {
+            for (std::size_t offset = 1; offset != gray_stacks_.size(); ++offset) {
+                auto& victim = gray_stacks_[(thief_index + offset) % gray_stacks_.size()];
+
+                std::vector<GC_control_block_base*> stolen;
+                {
+                    const std::lock_guard lock{victim.mutex};
+                    const auto n_stolen = (victim.control_blocks.size() + 1) / 2;
+                    stolen.assign(victim.control_blocks.cbegin(), victim.control_blocks.cbegin() + n_stolen);
+                    victim.control_blocks.erase(victim.control_blocks.cbegin(), victim.control_blocks.cbegin() + n_stolen);
+                }
+
+                if (! stolen.empty()) {
+                    auto& thief = gray_stacks_[thief_index];
+                    const std::lock_guard lock{thief.mutex};
+                    thief.control_blocks.insert(thief.control_blocks.end(), stolen.cbegin(), stolen.cend());
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void work(std::size_t index)
+        {
+            while (true) {
+                if (auto* control_block = pop(gray_stacks_[index])) {
+                    // Expected side-effect: References will be marked and pushed to this thread's gray stack.
+                    control_block->trace_refs(gc_heap_);
+                    continue;
+                }
+
+                if (steal(index)) {
+                    continue;
+                }
+
+                --n_busy_;
+                while (true) {
+                    if (n_busy_ == 0) {
+                        return;
+                    }
+
+                    ++n_busy_;
+                    if (steal(index)) {
+                        break;
+                    }
+                    --n_busy_;
+
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void help(std::size_t index)
+        {
+            gray_stack_index = index;
+
+            std::size_t last_round{0};
+            while (true) {
+                {
+                    std::unique_lock lock{round_mutex_};
+                    round_start_.wait(lock, [&] { return stopping_ || round_ != last_round; });
+                    if (stopping_) {
+                        return;
+                    }
+                    last_round = round_;
+                }
+
+                work(index);
+
+                {
+                    const std::lock_guard lock{round_mutex_};
+                    ++n_helpers_finished_;
+                }
+                round_end_.notify_one();
+            }
+        }
+
+      public:
+        Parallel_marker(GC_heap& gc_heap, std::size_t n_threads)
+            : gc_heap_{gc_heap},
+              gray_stacks_(n_threads)
+        {
+            for (std::size_t index = 1; index != n_threads; ++index) {
+                helper_threads_.emplace_back([this, index] { help(index); });
+            }
+        }
+
+        ~Parallel_marker()
+        {
+            {
+                const std::lock_guard lock{round_mutex_};
+                stopping_ = true;
+            }
+            round_start_.notify_all();
+
+            for (auto& helper_thread : helper_threads_) {
+                helper_thread.join();
+            }
+        }
+
+        void mark(GC_control_block_base& control_block)
+        {
+            // Objects don't change during marking, so the mark bit needs no ordering with anything else.
+            // Parallel marking is never incremental, so it doesn't track which objects were traced.
+            if (! Pool_allocator::set_marked_atomic(&control_block, control_block.size())) {
+                return;
+            }
+
+            auto& gray_stack = gray_stacks_[gray_stack_index];
+            const std::lock_guard lock{gray_stack.mutex};
+            gray_stack.control_blocks.push_back(&control_block);
+        }
+
+        // Trace from the already marked gray objects until every reachable object is marked.
+        void trace(std::vector<GC_control_block_base*>& gray_worklist)
+        {
+            for (std::size_t i = 0; i != gray_worklist.size(); ++i) {
+                gray_stacks_[i % gray_stacks_.size()].control_blocks.push_back(gray_worklist[i]);
+            }
+            gray_worklist.clear();
+            n_busy_ = gray_stacks_.size();
+
+            {
+                const std::lock_guard lock{round_mutex_};
+                ++round_;
+                n_helpers_finished_ = 0;
+            }
+            round_start_.notify_all();
+
+            work(0);
+
+            std::unique_lock lock{round_mutex_};
+            round_end_.wait(lock, [&] { return n_helpers_finished_ == helper_threads_.size(); });
+        }
+    };
+
+    Pool_allocator::~Pool_allocator()
+    {
+        for (auto* page : pages_) {
+            deallocate_page(page);
+        }
+        for (auto* header : large_headers_) {
+            ::operator delete(header, std::align_val_t{alignof(Large_header)});
+        }
+    }
+
+    Pool_allocator::Page_header* Pool_allocator::allocate_page()
+    {
+        return ::new (::operator new(page_size, std::align_val_t{page_size})) Page_header{};
+    }
+
+    void Pool_allocator::deallocate_page(Page_header* page)
+    {
+        ::operator delete(page, std::align_val_t{page_size});
+    }
+
+    class GC_heap::Pause
+    {
+        GC_heap& gc_heap_;
+        const bool outermost_;
+        const std::chrono::steady_clock::time_point begin_time_;
+
+      public:
+        explicit Pause(GC_heap& gc_heap)
+            : gc_heap_{gc_heap},
+              outermost_{! gc_heap.pausing_},
+              begin_time_{std::chrono::steady_clock::now()}
+        {
+            gc_heap_.pausing_ = true;
+        }
+
+        ~Pause()
+        {
+            if (! outermost_) {
+                return;
+            }
+
+            gc_heap_.pausing_ = false;
+            const auto pause_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin_time_);
+
+            auto& stats = gc_heap_.stats_;
+            ++stats.n_pauses;
+            stats.total_pause_time += pause_time;
+            stats.max_pause_time = std::max(stats.max_pause_time, pause_time);
+        }
+
+        // Non-copyable. This times a scope.
+        Pause(const Pause&) = delete;
+        Pause& operator=(const Pause&) = delete;
+    };
+
+    std::array<GC_type_info, max_n_gc_types> gc_type_infos;
+
+    std::uint8_t register_gc_type(const GC_type_info& type_info)
+    {
+        // Types register from function local statics, which can initialize on any thread.
+        static std::mutex mutex;
+        static std::size_t n_types{0};
+
+        const std::lock_guard lock{mutex};
+        if (n_types == max_n_gc_types) {
+            throw std::length_error{"Too many GC types."};
+        }
+
+        gc_type_infos[n_types] = type_info;
+        return static_cast<std::uint8_t>(n_types++);
+    }
+
+    std::byte* Pool_allocator::allocate_from_new_page(std::size_t rounded_size)
+    {
+        // Don't lose track of the page if the push throws.
+        pages_.reserve(pages_.size() + 1);
+        pages_.push_back(allocate_page());
+
+        auto* first_block = reinterpret_cast<std::byte*>(pages_.back()) + sizeof(Page_header);
+        bump_next_ = first_block + rounded_size;
+        bump_end_ = reinterpret_cast<std::byte*>(pages_.back()) + page_size;
+
+        return first_block;
+    }
+
+    void* Pool_allocator::allocate_large(std::size_t size)
+    {
+        auto* header = ::new (::operator new(sizeof(Large_header) + size, std::align_val_t{alignof(Large_header)})) Large_header{};
+        try {
+            large_headers_.insert(header);
+        } catch (...) {
+            ::operator delete(header, std::align_val_t{alignof(Large_header)});
+            throw;
+        }
+        n_large_bytes_ += sizeof(Large_header) + size;
+
+        return header + 1;
+    }
+
+    void Pool_allocator::deallocate_large(void* block, std::size_t size)
+    {
+        auto* header = &large_header(block);
+        large_headers_.erase(header);
+        n_large_bytes_ -= sizeof(Large_header) + size;
+        ::operator delete(header, std::align_val_t{alignof(Large_header)});
+    }
+
+    void Pool_allocator::clear_all_marks()
+    {
+        for (auto* page : pages_) {
+            std::memset(page, 0, sizeof(Page_header));
+        }
+        for (auto* header : large_headers_) {
+            *header = {};
+        }
+    }
+
+    std::size_t Pool_allocator::reserved_size() const
+    {
+        return pages_.size() * page_size + n_large_bytes_;
+    }
+
+    void Pool_allocator::swap(Pool_allocator& other) noexcept
+    {
+        std::swap(free_lists_, other.free_lists_);
+        std::swap(pages_, other.pages_);
+        std::swap(large_headers_, other.large_headers_);
+        std::swap(n_large_bytes_, other.n_large_bytes_);
+        std::swap(bump_next_, other.bump_next_);
+        std::swap(bump_end_, other.bump_end_);
+    }
+
+    GC_heap::GC_heap(
+        double growth_factor,
+        std::size_t min_heap_size,
+        std::size_t mark_slice_budget,
+        std::size_t n_mark_threads,
+        double compact_threshold,
+        std::size_t max_heap_size
+    )
+        : growth_factor_{growth_factor},
+          min_heap_size_{min_heap_size},
+          nursery_size_{std::min(max_nursery_size, min_heap_size)},
+          next_full_collect_size_{min_heap_size},
+          mark_slice_budget_{mark_slice_budget},
+          compact_threshold_{compact_threshold},
+          max_heap_size_{max_heap_size}
+    {
+        if (! (growth_factor >= 1)) {
+            throw std::invalid_argument{"GC growth factor must be at least 1."};
+        }
+
+        if (n_mark_threads == 0) {
+            throw std::invalid_argument{"GC mark thread count must be at least 1."};
+        }
+
+        if (! (compact_threshold >= 0 && compact_threshold < 1)) {
+            throw std::invalid_argument{"GC compaction threshold must be at least 0 and less than 1."};
+        }
+
+        if (n_mark_threads > 1) {
+            parallel_marker_ = std::make_unique<Parallel_marker>(*this, n_mark_threads);
+        }
+    }
+
+    GC_heap::~GC_heap()
+    {
+        // Mid-sweep, the old list still holds the objects that this sweep already destroyed, between the write and read indexes.
+        if (sweeping_) {
+            old_ptrs_.erase(old_ptrs_.cbegin() + sweep_write_index_, old_ptrs_.cbegin() + sweep_read_index_);
+        }
+
+        for (auto* ptrs : {&young_ptrs_, &old_ptrs_}) {
+            for (auto* control_block : *ptrs) {
+                const auto size = control_block->size();
+                control_block->destroy();
+                pool_allocator_.deallocate(control_block, size);
+            }
+        }
+    }
+
     void GC_heap::mark(GC_control_block_base& control_block)
     {
-        if (control_block.marked) {
+        if (collecting_young_only_ && control_block.old) {
             return;
         }
 
-        control_block.marked = true;
+        if (parallel_marking_) {
+            parallel_marker_->mark(control_block);
+            return;
+        }
+
+        if (Pool_allocator::marked(&control_block, control_block.size())) {
+            return;
+        }
+
+        Pool_allocator::set_marked(&control_block, control_block.size(), true);
         gray_worklist_.push_back(&control_block);
     }
 
-    void GC_heap::collect_garbage()
+    bool GC_heap::marked(const GC_control_block_base& control_block) const
+    {
+        return Pool_allocator::marked(&control_block, control_block.size());
+    }
+
+    bool GC_heap::traced(const GC_control_block_base& control_block) const
+    {
+        return Pool_allocator::traced(&control_block, control_block.size());
+    }
+
+    void GC_heap::mark_roots()
     {
         // Expected side-effect: Gray worklist will be populated with roots.
         for (const auto& mark_roots_fn : on_mark_roots) {
             mark_roots_fn();
         }
+    }
 
-        while (! gray_worklist_.empty()) {
+    bool GC_heap::trace_gray(std::size_t max_n_traced)
+    {
+        for (std::size_t n_traced = 0; n_traced != max_n_traced && ! gray_worklist_.empty(); ++n_traced) {
             auto* gray_control_block = gray_worklist_.back();
             gray_worklist_.pop_back();
 
             // Expected side-effect: References will be marked and added to gray worklist.
+            Pool_allocator::set_traced(gray_control_block, gray_control_block->size(), true);
             gray_control_block->trace_refs(*this);
         }
+
+        return gray_worklist_.empty();
+    }
+
+    void GC_heap::mark_roots_and_trace()
+    {
+        mark_roots();
+
+        if (parallel_marker_) {
+            parallel_marking_ = true;
+            parallel_marker_->trace(gray_worklist_);
+            parallel_marking_ = false;
+        } else {
+            trace_gray(std::numeric_limits<std::size_t>::max());
+        }
         gray_worklist_.shrink_to_fit();
 
-        const auto not_marked_begin =
-            std::partition(all_ptrs_.begin(), all_ptrs_.end(), [](const auto& control_block) { return control_block->marked; });
-        std::for_each(not_marked_begin, all_ptrs_.end(), [&](const auto& control_block) {
-            for (const auto& on_destroy_fn : on_destroy_ptr) {
-                on_destroy_fn(*control_block);
+        for (const auto& clear_weak_refs_fn : on_clear_weak_refs) {
+            clear_weak_refs_fn();
+        }
+    }
+
+    void GC_heap::destroy(GC_control_block_base& control_block)
+    {
+        // Return the memory to its pool rather than delete it.
+        const auto size = control_block.size();
+        const auto owned_size = control_block.owned_size();
+        n_allocated_bytes_ -= size + owned_size;
+        n_owned_bytes_ -= owned_size;
+        stats_.total_freed_bytes += size + owned_size;
+        ++stats_.total_freed_objects;
+        --n_live_objects_by_type_[control_block.type_tag];
+        control_block.destroy();
+        pool_allocator_.deallocate(&control_block, size);
+    }
+
+    void GC_heap::sweep_young()
+    {
+        std::size_t n_kept{0};
+        for (auto* control_block : young_ptrs_) {
+            if (! Pool_allocator::marked(control_block, control_block->size())) {
+                destroy(*control_block);
+                continue;
             }
-            n_allocated_bytes_ -= control_block->size();
-        });
-        all_ptrs_.erase(not_marked_begin, all_ptrs_.end());
 
-        for (auto& control_block : all_ptrs_) {
-            control_block->marked = false;
+            Pool_allocator::set_marked(control_block, control_block->size(), false);
+            Pool_allocator::set_traced(control_block, control_block->size(), false);
+            young_ptrs_[n_kept++] = control_block;
         }
+        young_ptrs_.resize(n_kept);
+    }
+
+    void GC_heap::start_sweep()
+    {
+        // Every survivor will be old, so no old object can refer to a young one.
+        forget_remembered();
+        promote_young();
+
+        // Until they're swept, the dead objects are the unmarked ones.
+        sweeping_ = true;
+        sweep_read_index_ = 0;
+        sweep_write_index_ = 0;
+    }
+
+    bool GC_heap::sweep_old(std::size_t max_n_swept)
+    {
+        const auto sweep_end_index =
+            old_ptrs_.size() - sweep_read_index_ > max_n_swept ? sweep_read_index_ + max_n_swept : old_ptrs_.size();
+        for (; sweep_read_index_ != sweep_end_index; ++sweep_read_index_) {
+            // Only the bitmap is read, so live objects aren't touched.
+            auto* control_block = old_ptrs_[sweep_read_index_];
+            if (! Pool_allocator::marked(control_block, control_block->size())) {
+                destroy(*control_block);
+            } else {
+                old_ptrs_[sweep_write_index_++] = control_block;
+            }
+        }
+
+        if (sweep_read_index_ != old_ptrs_.size()) {
+            return false;
+        }
+
+        old_ptrs_.resize(sweep_write_index_);
+        sweeping_ = false;
+
+        // Clearing every bitmap unmarks every survivor at once, with no pass over them.
+        pool_allocator_.clear_all_marks();
+
+        const auto grown_size = static_cast<std::size_t>(static_cast<double>(n_allocated_bytes_) * growth_factor_);
+        next_full_collect_size_ = std::max(min_heap_size_, grown_size);
+
+        ++stats_.n_full_collections;
+        end_collection();
+
+        return true;
+    }
+
+    void GC_heap::end_collection()
+    {
+        for (const auto& collection_end_fn : on_collection_end) {
+            collection_end_fn();
+        }
+    }
+
+    void GC_heap::promote_young()
+    {
+        for (auto* control_block : young_ptrs_) {
+            control_block->old = true;
+        }
+        old_ptrs_.insert(old_ptrs_.end(), young_ptrs_.cbegin(), young_ptrs_.cend());
+        young_ptrs_.clear();
+        n_young_bytes_ = 0;
+    }
+
+    void GC_heap::forget_remembered()
+    {
+        for (auto* control_block : remembered_set_) {
+            control_block->remembered = false;
+        }
+        remembered_set_.clear();
+    }
+
+    void GC_heap::finish_full_mark()
+    {
+        // Roots are marked again even when finishing incremental marking, because roots don't have write barriers.
+        incremental_marking_ = false;
+        mark_roots_and_trace();
+    }
+
+    void GC_heap::collect_garbage()
+    {
+        const Pause pause{*this};
+
+        if (sweeping_) {
+            sweep_old(std::numeric_limits<std::size_t>::max());
+        }
+
+        finish_full_mark();
+        start_sweep();
+        sweep_old(std::numeric_limits<std::size_t>::max());
+    }
+
+    void GC_heap::collect_young_garbage()
+    {
+        const Pause pause{*this};
+
+        // Marks from a young collection can't mix with the marks of an unfinished full collection.
+        if (incremental_marking_) {
+            collect_garbage();
+            return;
+        }
+
+        if (sweeping_) {
+            sweep_old(std::numeric_limits<std::size_t>::max());
+        }
+
+        collecting_young_only_ = true;
+
+        // Remembered old objects aren't marked themselves, but their young references are.
+        for (auto* control_block : remembered_set_) {
+            control_block->trace_refs(*this);
+        }
+        mark_roots_and_trace();
+
+        // Survivors are promoted, so after this there are no young objects for old objects to refer to.
+        forget_remembered();
+        sweep_young();
+        promote_young();
+
+        collecting_young_only_ = false;
+
+        ++stats_.n_young_collections;
+        end_collection();
+    }
+
+    void GC_heap::collect_garbage_if_due()
+    {
+        if (! collection_due()) {
+            return;
+        }
+
+        const Pause pause{*this};
+
+        if (over_limit()) {
+            collect_garbage();
+            if (over_limit()) {
+                throw GC_heap_limit_error{};
+            }
+
+            return;
+        }
+
+        if (sweeping_) {
+            sweep_old(sweep_slice_size);
+            return;
+        }
+
+        if (incremental_marking_) {
+            if (trace_gray(mark_slice_budget_)) {
+                finish_full_mark();
+                start_sweep();
+            }
+
+            return;
+        }
+
+        if (! full_collection_due()) {
+            collect_young_garbage();
+        } else if (mark_slice_budget_ == 0) {
+            finish_full_mark();
+            start_sweep();
+        } else {
+            // Young collections wait until this full collection finishes.
+            incremental_marking_ = true;
+            mark_roots();
+            trace_gray(mark_slice_budget_);
+        }
+    }
+
+    bool GC_heap::is_dead(const GC_control_block_base& control_block) const
+    {
+        return sweeping_ && ! Pool_allocator::marked(&control_block, control_block.size());
     }
 
     std::size_t GC_heap::size() const
     {
         return n_allocated_bytes_;
     }
+
+    void GC_heap::add_owned_size(std::size_t owned_size)
+    {
+        n_allocated_bytes_ += owned_size;
+        n_young_bytes_ += owned_size;
+        n_owned_bytes_ += owned_size;
+        stats_.total_allocated_bytes += owned_size;
+    }
+
+    std::size_t GC_heap::young_size() const
+    {
+        return n_young_bytes_;
+    }
+
+    std::size_t GC_heap::reserved_size() const
+    {
+        return pool_allocator_.reserved_size();
+    }
+
+    bool GC_heap::compaction_due() const
+    {
+        // Compaction can only give back whole pages, and the page it packs into last is partly empty.
+        const auto reserved_size = pool_allocator_.reserved_size();
+        const auto compacted_size = ((n_allocated_bytes_ - n_owned_bytes_) / Pool_allocator::page_size + 1) * Pool_allocator::page_size;
+        return compact_threshold_ > 0 && reserved_size > min_heap_size_ && reserved_size > compacted_size &&
+               static_cast<double>(reserved_size - compacted_size) > static_cast<double>(reserved_size) * compact_threshold_;
+    }
+
+    void GC_heap::compact()
+    {
+        const Pause pause{*this};
+
+        // Afterward, every object is a marked survivor in the old list, and nothing is left to sweep or remember.
+        collect_garbage();
+
+        // Take every destination block first, so that if the pool runs out of memory, nothing has moved yet.
+        Pool_allocator from_pool;
+        pool_allocator_.swap(from_pool);
+
+        std::vector<void*> to_blocks;
+        try {
+            to_blocks.reserve(old_ptrs_.size());
+            for (auto* control_block : old_ptrs_) {
+                to_blocks.push_back(pool_allocator_.allocate(control_block->size()));
+            }
+        } catch (...) {
+            pool_allocator_.swap(from_pool);
+            throw;
+        }
+
+        // Leave each object's new address in its old block, where the updates will look it up.
+        [&]() noexcept {
+            for (std::size_t i = 0; i != old_ptrs_.size(); ++i) {
+                auto* from_block = old_ptrs_[i];
+                old_ptrs_[i] = &from_block->relocate(to_blocks[i]);
+                ::new (static_cast<void*>(from_block)) GC_control_block_base*{old_ptrs_[i]};
+            }
+        }();
+
+        for (const auto& update_roots_fn : on_update_roots) {
+            update_roots_fn();
+        }
+        for (auto* control_block : old_ptrs_) {
+            control_block->update_refs(*this);
+        }
+
+        ++stats_.n_compactions;
+
+        // Destroying the old pool releases the old pages, which now hold only forwarding addresses.
+    }
+
+    GC_stats GC_heap::stats() const
+    {
+        auto stats = stats_;
+        stats.live_bytes = n_allocated_bytes_;
+        stats.reserved_bytes = pool_allocator_.reserved_size();
+
+        std::map<std::size_t, std::size_t> n_objects_by_size;
+        for (std::size_t type_tag = 0; type_tag != max_n_gc_types; ++type_tag) {
+            const auto n_objects = n_live_objects_by_type_[type_tag];
+            if (n_objects == 0) {
+                continue;
+            }
+
+            const auto& type_info = gc_type_infos[type_tag];
+            stats.live_objects_by_type.push_back({boost::core::demangle(type_info.name), n_objects, n_objects * type_info.size});
+            n_objects_by_size[type_info.size] += n_objects;
+        }
+
+        for (const auto& [object_size, n_objects] : n_objects_by_size) {
+            stats.live_objects_by_size.push_back({object_size, n_objects});
+        }
+
+        return stats;
+    }
+
+    void print_json(std::ostream& os, const GC_stats& stats)
+    {
+        // Type names are the only strings. They can't hold control characters, but escape quotes and backslashes to be safe.
+        const auto print_string = [&](const std::string& str) {
+            os << '"';
+            for (const auto c : str) {
+                if (c == '"' || c == '\\') {
+                    os << '\\';
+                }
+                os << c;
+            }
+            os << '"';
+        };
+
+        os << "{\n";
+        os << "    \"n_young_collections\": " << stats.n_young_collections << ",\n";
+        os << "    \"n_full_collections\": " << stats.n_full_collections << ",\n";
+        os << "    \"n_compactions\": " << stats.n_compactions << ",\n";
+        os << "    \"n_pauses\": " << stats.n_pauses << ",\n";
+        os << "    \"total_pause_ns\": " << stats.total_pause_time.count() << ",\n";
+        os << "    \"max_pause_ns\": " << stats.max_pause_time.count() << ",\n";
+        os << "    \"total_allocated_bytes\": " << stats.total_allocated_bytes << ",\n";
+        os << "    \"total_freed_bytes\": " << stats.total_freed_bytes << ",\n";
+        os << "    \"total_allocated_objects\": " << stats.total_allocated_objects << ",\n";
+        os << "    \"total_freed_objects\": " << stats.total_freed_objects << ",\n";
+        os << "    \"live_bytes\": " << stats.live_bytes << ",\n";
+        os << "    \"reserved_bytes\": " << stats.reserved_bytes << ",\n";
+
+        os << "    \"live_objects_by_type\": [";
+        for (std::size_t i = 0; i != stats.live_objects_by_type.size(); ++i) {
+            const auto& type_count = stats.live_objects_by_type[i];
+            os << (i == 0 ? "\n" : ",\n") << "        {\"type\": ";
+            print_string(type_count.type_name);
+            os << ", \"n_objects\": " << type_count.n_objects << ", \"n_bytes\": " << type_count.n_bytes << '}';
+        }
+        os << (stats.live_objects_by_type.empty() ? "],\n" : "\n    ],\n");
+
+        os << "    \"live_objects_by_size\": [";
+        for (std::size_t i = 0; i != stats.live_objects_by_size.size(); ++i) {
+            const auto& size_count = stats.live_objects_by_size[i];
+            os << (i == 0 ? "\n" : ",\n") << "        {\"size\": " << size_count.object_size << ", \"n_objects\": " << size_count.n_objects << '}';
+        }
+        os << (stats.live_objects_by_size.empty() ? "]\n" : "\n    ]\n");
+        os << "}\n";
+    }
+
+    GC_control_block_base* GC_heap::forwarding_address(const GC_control_block_base& control_block) const
+    {
+        return *std::launder(reinterpret_cast<GC_control_block_base* const*>(&control_block));
+    }
 }
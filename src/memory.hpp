@@ -1,53 +1,170 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
 #include <ostream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
 #include <vector>
 
 namespace motts::lox
 {
     class GC_heap;
+    class Parallel_marker;
 
-    // Every garbage collect-able object can be polymorphically marked and trace references.
+    struct GC_control_block_base;
+
+    // How to trace, size, and destroy one type of control block. Rather than a vtable pointer in every object,
+    // each object holds a one byte tag that indexes a table of these.
+    struct GC_type_info
+    {
+        // The mangled name from typeid, for stats.
+        const char* name;
+
+        void (*trace_refs)(const GC_control_block_base&, GC_heap&);
+        void (*update_refs)(GC_control_block_base&, GC_heap&);
+        void (*relocate)(GC_control_block_base&, void* to);
+        void (*destroy)(GC_control_block_base&);
+        std::size_t (*owned_size)(const GC_control_block_base&);
+        std::size_t size;
+    };
+
+    inline constexpr std::size_t max_n_gc_types{256};
+    extern std::array<GC_type_info, max_n_gc_types> gc_type_infos;
+
+    // Add a type to the table and return its tag. Throws std::length_error if the table is full.
+    std::uint8_t register_gc_type(const GC_type_info&);
+
+    // Every garbage collect-able object can be marked and trace references, dispatched by its type tag.
+    // The mark state itself lives in the heap's side bitmaps.
     struct GC_control_block_base
     {
-        bool marked{false};
+        std::uint8_t type_tag;
+
+        // Survived a collection, so only a full collection will trace or destroy it.
+        bool old{false};
+
+        // An old object that was written to since the last collection, so it may now refer to young objects.
+        bool remembered{false};
+
+        explicit GC_control_block_base(std::uint8_t type_tag_arg)
+            : type_tag{type_tag_arg}
+        {
+        }
+
+        void trace_refs(GC_heap& gc_heap) const
+        {
+            gc_type_infos[type_tag].trace_refs(*this, gc_heap);
+        }
+
+        std::size_t size() const
+        {
+            return gc_type_infos[type_tag].size;
+        }
+
+        // Bytes the object owns outside its control block.
+        std::size_t owned_size() const
+        {
+            return gc_type_infos[type_tag].owned_size(*this);
+        }
 
-        virtual ~GC_control_block_base() = default;
-        virtual void trace_refs(GC_heap&) const = 0;
-        virtual std::size_t size() const = 0;
+        // After compaction, point each reference this object holds at where the referent moved to.
+        void update_refs(GC_heap& gc_heap)
+        {
+            gc_type_infos[type_tag].update_refs(*this, gc_heap);
+        }
+
+        // Move into the given memory, and destroy what's left here. Returns the moved control block.
+        GC_control_block_base& relocate(void* to)
+        {
+            gc_type_infos[type_tag].relocate(*this, to);
+            return *static_cast<GC_control_block_base*>(to);
+        }
+
+        // Run the derived destructor. The memory is the caller's to free.
+        void destroy()
+        {
+            gc_type_infos[type_tag].destroy(*this);
+        }
     };
 
     // I don't want user code to be required to extend my GC class, so instead I'll let them specialize a
-    // function template, and I'll implement the virtual trace_refs for them to invoke the specialization.
+    // function template, and each type's table entry will invoke the specialization.
     template<typename User_value_type>
     void trace_refs_trait(GC_heap&, const User_value_type&)
     {
         // Default is no-op.
     }
 
+    // Likewise, a type that holds references specializes this to update each of them with `update_ref` after compaction.
+    template<typename User_value_type>
+    void update_refs_trait(GC_heap&, User_value_type&)
+    {
+        // Default is no-op.
+    }
+
+    // And a type that owns memory outside its control block, such as a string's characters, specializes this to say how much,
+    // so that memory counts toward collections and the heap limit. If the answer grows over the object's life,
+    // the object reports the growth with `GC_heap::add_owned_size` as it happens.
+    template<typename User_value_type>
+    std::size_t owned_size_trait(const User_value_type&)
+    {
+        return 0;
+    }
+
+    template<typename User_value_type>
+    struct GC_control_block;
+
+    // Each type registers its table entry the first time one is made.
+    template<typename User_value_type>
+    std::uint8_t gc_type_tag()
+    {
+        using Control_block = GC_control_block<User_value_type>;
+
+        static const auto type_tag = register_gc_type({
+            typeid(User_value_type).name(),
+            [](const GC_control_block_base& control_block, GC_heap& gc_heap) {
+                trace_refs_trait(gc_heap, static_cast<const Control_block&>(control_block).value);
+            },
+            [](GC_control_block_base& control_block, GC_heap& gc_heap) {
+                update_refs_trait(gc_heap, static_cast<Control_block&>(control_block).value);
+            },
+            [](GC_control_block_base& control_block, void* to) {
+                auto& from_control_block = static_cast<Control_block&>(control_block);
+                auto* to_control_block = ::new (to) Control_block{std::move(from_control_block.value)};
+                to_control_block->old = from_control_block.old;
+                to_control_block->remembered = from_control_block.remembered;
+                from_control_block.~Control_block();
+            },
+            [](GC_control_block_base& control_block) { static_cast<Control_block&>(control_block).~Control_block(); },
+            [](const GC_control_block_base& control_block) {
+                return owned_size_trait(static_cast<const Control_block&>(control_block).value);
+            },
+            sizeof(Control_block),
+        });
+
+        return type_tag;
+    }
+
     // Generate a concrete derived control block type for each user value type.
-    // It will hold the user value together with the base marked flag,
-    // and it will invoke the correct trace_refs_trait specialization.
+    // It will hold the user value together with the base type tag and generation flags.
     template<typename User_value_type>
     struct GC_control_block : GC_control_block_base
     {
         User_value_type value;
 
         GC_control_block(User_value_type&& value_arg)
-            : value{std::move(value_arg)}
-        {
-        }
-
-        void trace_refs(GC_heap& gc_heap) const override
+            : GC_control_block_base{gc_type_tag<User_value_type>()},
+              value{std::move(value_arg)}
         {
-            trace_refs_trait(gc_heap, value);
-        }
-
-        std::size_t size() const override
-        {
-            return sizeof(*this);
         }
     };
 
@@ -101,47 +218,507 @@ namespace motts::lox
         return os;
     }
 
+    // Most Lox objects are small and short lived, so rather than go to the system allocator for each one,
+    // small blocks are bump allocated out of large pages, and freed blocks are kept on a free list per size class.
+    // The size classes cover every Lox object. A block larger than that comes from the system allocator,
+    // behind a small header of its own.
+    //
+    // Each page begins with side bitmaps that hold the GC's mark state, one bit per size class granule, rather than
+    // keeping the mark state in the objects. Marking then doesn't dirty every live object's cache line, and all marks clear
+    // with one memset per page. Pages are aligned to their size, so a block's bitmap is found by masking its address.
+    // A large block's bits are in its header instead, which is why the mark state queries take the block's size.
+    class Pool_allocator
+    {
+      public:
+        static constexpr std::size_t page_size{64 * 1024};
+        static constexpr std::size_t max_pooled_size{512};
+
+      private:
+        static constexpr std::size_t size_class_granularity{alignof(std::max_align_t)};
+
+        struct Page_header
+        {
+            static constexpr std::size_t n_bitmap_words{page_size / size_class_granularity / 64};
+
+            std::array<std::uint64_t, n_bitmap_words> mark_bits;
+            std::array<std::uint64_t, n_bitmap_words> traced_bits;
+        };
+
+        // Just before a large block. Its bits are the lowest bit of each word.
+        struct alignas(std::max_align_t) Large_header
+        {
+            std::uint64_t mark_bits;
+            std::uint64_t traced_bits;
+        };
+
+        // A freed block stores the link to the next free block of the same size class inside its own bytes.
+        struct Free_block
+        {
+            Free_block* next;
+        };
+
+        std::array<Free_block*, max_pooled_size / size_class_granularity> free_lists_{};
+        std::vector<Page_header*> pages_;
+        std::unordered_set<Large_header*> large_headers_;
+        std::size_t n_large_bytes_{0};
+        std::byte* bump_next_{};
+        std::byte* bump_end_{};
+
+        static std::size_t size_class_index(std::size_t size)
+        {
+            return (size - 1) / size_class_granularity;
+        }
+
+        static Page_header* allocate_page();
+        static void deallocate_page(Page_header*);
+
+        // Start a new page when the current one can't fit the next block. Whatever was left in the old page goes unused.
+        std::byte* allocate_from_new_page(std::size_t rounded_size);
+
+        void* allocate_large(std::size_t size);
+        void deallocate_large(void* block, std::size_t size);
+
+        static Page_header& page_header(const void* block)
+        {
+            return *reinterpret_cast<Page_header*>(reinterpret_cast<std::uintptr_t>(block) & ~(page_size - 1));
+        }
+
+        static Large_header& large_header(const void* block)
+        {
+            return *(reinterpret_cast<Large_header*>(const_cast<void*>(block)) - 1);
+        }
+
+        static std::size_t bit_index(const void* block)
+        {
+            return (reinterpret_cast<std::uintptr_t>(block) & (page_size - 1)) / size_class_granularity;
+        }
+
+        static std::uint64_t bit_mask(const void* block, std::size_t size)
+        {
+            return size > max_pooled_size ? 1 : std::uint64_t{1} << (bit_index(block) % 64);
+        }
+
+        static std::uint64_t& mark_word(const void* block, std::size_t size)
+        {
+            return size > max_pooled_size ? large_header(block).mark_bits : page_header(block).mark_bits[bit_index(block) / 64];
+        }
+
+        static std::uint64_t& traced_word(const void* block, std::size_t size)
+        {
+            return size > max_pooled_size ? large_header(block).traced_bits : page_header(block).traced_bits[bit_index(block) / 64];
+        }
+
+      public:
+        Pool_allocator() = default;
+        ~Pool_allocator();
+
+        // Non-copyable. This is a resource owning class.
+        Pool_allocator(const Pool_allocator&) = delete;
+        Pool_allocator& operator=(const Pool_allocator&) = delete;
+
+        void* allocate(std::size_t size)
+        {
+            if (size > max_pooled_size) {
+                return allocate_large(size);
+            }
+
+            auto& free_list = free_lists_[size_class_index(size)];
+            if (free_list) {
+                auto* block = free_list;
+                free_list = block->next;
+                return block;
+            }
+
+            const auto rounded_size = (size_class_index(size) + 1) * size_class_granularity;
+            if (static_cast<std::size_t>(bump_end_ - bump_next_) < rounded_size) {
+                return allocate_from_new_page(rounded_size);
+            }
+
+            auto* block = bump_next_;
+            bump_next_ += rounded_size;
+            return block;
+        }
+
+        // The size must be the same size that was allocated.
+        void deallocate(void* block, std::size_t size)
+        {
+            if (size > max_pooled_size) {
+                deallocate_large(block, size);
+                return;
+            }
+
+            auto& free_list = free_lists_[size_class_index(size)];
+            free_list = ::new (block) Free_block{free_list};
+        }
+
+        // The mark and traced bits of a block. The block must have come from this allocator, with this size.
+        static bool marked(const void* block, std::size_t size)
+        {
+            return mark_word(block, size) & bit_mask(block, size);
+        }
+
+        static void set_marked(const void* block, std::size_t size, bool value)
+        {
+            auto& word = mark_word(block, size);
+            word = value ? word | bit_mask(block, size) : word & ~bit_mask(block, size);
+        }
+
+        // For marking on several threads at once. Returns true if this call is the one that set the bit.
+        static bool set_marked_atomic(const void* block, std::size_t size)
+        {
+            const auto mask = bit_mask(block, size);
+            return ! (std::atomic_ref{mark_word(block, size)}.fetch_or(mask, std::memory_order_relaxed) & mask);
+        }
+
+        static bool traced(const void* block, std::size_t size)
+        {
+            return traced_word(block, size) & bit_mask(block, size);
+        }
+
+        static void set_traced(const void* block, std::size_t size, bool value)
+        {
+            auto& word = traced_word(block, size);
+            word = value ? word | bit_mask(block, size) : word & ~bit_mask(block, size);
+        }
+
+        // Clear the mark and traced bits of every block.
+        void clear_all_marks();
+
+        // Bytes taken from the system, whether they hold live blocks, free blocks, or nothing yet.
+        std::size_t reserved_size() const;
+
+        void swap(Pool_allocator&) noexcept;
+    };
+
+    // Thrown at a safe point when the live objects still exceed the heap's limit after an emergency full collection.
+    class GC_heap_limit_error : public std::bad_alloc
+    {
+      public:
+        const char* what() const noexcept override
+        {
+            return "GC heap limit exceeded.";
+        }
+    };
+
+    // What the heap has done so far, for tuning its thresholds to a workload.
+    struct GC_stats
+    {
+        std::size_t n_young_collections{0};
+        std::size_t n_full_collections{0};
+        std::size_t n_compactions{0};
+
+        // Each call that did collection work is one pause, including each slice of an incremental collection or lazy sweep.
+        std::size_t n_pauses{0};
+        std::chrono::nanoseconds total_pause_time{0};
+        std::chrono::nanoseconds max_pause_time{0};
+
+        // Totals over the heap's lifetime.
+        std::size_t total_allocated_bytes{0};
+        std::size_t total_freed_bytes{0};
+        std::size_t total_allocated_objects{0};
+        std::size_t total_freed_objects{0};
+
+        // Live means not yet freed, which includes garbage that no collection has found yet.
+        std::size_t live_bytes{0};
+        std::size_t reserved_bytes{0};
+
+        struct Type_count
+        {
+            std::string type_name;
+            std::size_t n_objects;
+            std::size_t n_bytes;
+        };
+
+        struct Size_count
+        {
+            std::size_t object_size;
+            std::size_t n_objects;
+        };
+
+        // Only types and sizes with live objects are listed. Sizes are in ascending order.
+        std::vector<Type_count> live_objects_by_type;
+        std::vector<Size_count> live_objects_by_size;
+    };
+
+    // Writes the stats as one JSON object.
+    void print_json(std::ostream&, const GC_stats&);
+
     class GC_heap
     {
-        std::vector<std::unique_ptr<GC_control_block_base>> all_ptrs_;
+        Pool_allocator pool_allocator_;
+
+        // Objects are made young and are promoted to old when they survive a collection.
+        std::vector<GC_control_block_base*> young_ptrs_;
+        std::vector<GC_control_block_base*> old_ptrs_;
+        std::vector<GC_control_block_base*> remembered_set_;
+
         std::vector<GC_control_block_base*> gray_worklist_;
         std::size_t n_allocated_bytes_{0};
+        std::size_t n_young_bytes_{0};
+
+        // The part of the allocated bytes that objects own outside the pool, which compaction can't give back.
+        std::size_t n_owned_bytes_{0};
+
+        // After each full collection, the next one is due once the heap grows by this factor, but not before it reaches the minimum size.
+        // Young collections are due every nursery size of allocations, which is capped by the minimum heap size.
+        const double growth_factor_;
+        const std::size_t min_heap_size_;
+        const std::size_t nursery_size_;
+        std::size_t next_full_collect_size_;
+
+        // During a young collection, old objects are treated as already marked.
+        bool collecting_young_only_{false};
+
+        // A full collection can mark a bounded number of objects per slice, between which the program keeps running.
+        // Zero means a full collection marks everything at once.
+        const std::size_t mark_slice_budget_;
+        bool incremental_marking_{false};
+
+        // Null if marking runs only on the collecting thread.
+        std::unique_ptr<Parallel_marker> parallel_marker_;
+        bool parallel_marking_{false};
+
+        // After a full collection's marking, old objects are swept a slice at a time at later safe points.
+        // Survivors are compacted to the front of the old list as the sweep goes.
+        static constexpr std::size_t sweep_slice_size{256};
+        bool sweeping_{false};
+        std::size_t sweep_read_index_{0};
+        std::size_t sweep_write_index_{0};
+
+        void mark_roots();
+
+        // Trace at most max_n_traced gray objects. Returns true if there are no gray objects left.
+        bool trace_gray(std::size_t max_n_traced);
+
+        void mark_roots_and_trace();
+        void finish_full_mark();
+
+        void destroy(GC_control_block_base&);
+
+        // Destroy the unmarked young objects and clear the marks of the rest, which are few enough to clear one by one.
+        void sweep_young();
+
+        // Promote all young objects, so all old objects wait to be swept.
+        void start_sweep();
+
+        // Sweep at most max_n_swept old objects. Returns true if the sweep is done.
+        bool sweep_old(std::size_t max_n_swept);
+
+        void promote_young();
+        void forget_remembered();
+
+        // Compaction runs once the fraction of reserved memory that isn't allocated exceeds this. Zero means never.
+        const double compact_threshold_;
+
+        // Allocated bytes beyond this force an emergency full collection at the next safe point. Zero means no limit.
+        const std::size_t max_heap_size_;
+
+        // Only the counters. The per type and per size lists are filled in when asked for.
+        GC_stats stats_;
+        std::array<std::size_t, max_n_gc_types> n_live_objects_by_type_{};
+
+        // Times a public call that does collection work. Nested calls are part of the outer call's pause.
+        class Pause;
+        bool pausing_{false};
+
+        void end_collection();
 
       public:
         // When we mark-and-sweep, we need to start marking somewhere.
         // Add a callback to this list to mark your roots, whatever they may be.
         std::vector<std::function<void()>> on_mark_roots;
 
-        // Before we delete a ptr during collection, give others a chance to act on the pending deletion.
-        std::vector<std::function<void(const GC_control_block_base&)>> on_destroy_ptr;
+        // Weak tables hold references without marking them. After each marking, and before anything is deleted,
+        // these callbacks must forget every reference for which `survives` is false. Callbacks mustn't allocate.
+        std::vector<std::function<void()>> on_clear_weak_refs;
+
+        // After each young collection, and after each full collection finishes sweeping. Callbacks mustn't allocate.
+        std::vector<std::function<void()>> on_collection_end;
+
+        // After compaction moves objects, each root callback must `update_ref` every reference it would mark.
+        // Anything keyed by address, such as a hash map of GC_ptrs, must be rebuilt.
+        std::vector<std::function<void()>> on_update_roots;
 
-        GC_heap() = default;
+        static constexpr double default_growth_factor{2.0};
+        static constexpr std::size_t default_min_heap_size{1024 * 1024};
+        static constexpr std::size_t max_nursery_size{256 * 1024};
+        static constexpr std::size_t default_mark_slice_budget{0};
+        static constexpr std::size_t default_n_mark_threads{1};
+        static constexpr double default_compact_threshold{0};
+        static constexpr std::size_t default_max_heap_size{0};
+
+        // Throws std::invalid_argument if the growth factor is less than 1, the number of mark threads is 0,
+        // or the compaction threshold isn't in [0, 1).
+        explicit GC_heap(
+            double growth_factor = default_growth_factor,
+            std::size_t min_heap_size = default_min_heap_size,
+            std::size_t mark_slice_budget = default_mark_slice_budget,
+            std::size_t n_mark_threads = default_n_mark_threads,
+            double compact_threshold = default_compact_threshold,
+            std::size_t max_heap_size = default_max_heap_size
+        );
+        ~GC_heap();
 
         // Non-copyable. This is a resource owning class.
         GC_heap(const GC_heap&) = delete;
         GC_heap& operator=(const GC_heap&) = delete;
 
-        // Move your value into a heap allocated and tracked control block.
+        // Move your value into a pool allocated and tracked control block.
+        // Allocation counts toward the next collection but doesn't run it, because a collection here would destroy
+        // the caller's new objects that aren't reachable from a root yet. Instead, check `collection_due` at a safe point.
         template<typename User_value_type>
         GC_ptr<User_value_type> make(User_value_type&& value)
         {
-            auto control_block = std::make_unique<GC_control_block<User_value_type>>(std::move(value));
-            const GC_ptr<User_value_type> gc_ptr{control_block.get()};
+            using Control_block = GC_control_block<User_value_type>;
+            static_assert(alignof(Control_block) <= alignof(std::max_align_t), "Pool blocks are only aligned to max_align_t.");
 
-            n_allocated_bytes_ += control_block->size();
-            all_ptrs_.push_back(std::move(control_block));
+            // Make room in the tracking list first, so nothing is left to clean up if that throws.
+            young_ptrs_.emplace_back();
 
-            return gc_ptr;
+            void* memory{};
+            Control_block* control_block{};
+            try {
+                memory = pool_allocator_.allocate(sizeof(Control_block));
+                control_block = ::new (memory) Control_block{std::move(value)};
+            } catch (...) {
+                if (memory) {
+                    pool_allocator_.deallocate(memory, sizeof(Control_block));
+                }
+                young_ptrs_.pop_back();
+                throw;
+            }
+
+            const auto owned_size = owned_size_trait(control_block->value);
+            n_allocated_bytes_ += sizeof(Control_block) + owned_size;
+            n_young_bytes_ += sizeof(Control_block) + owned_size;
+            n_owned_bytes_ += owned_size;
+            stats_.total_allocated_bytes += sizeof(Control_block) + owned_size;
+            ++stats_.total_allocated_objects;
+            ++n_live_objects_by_type_[control_block->type_tag];
+            young_ptrs_.back() = control_block;
+            Pool_allocator::set_traced(control_block, sizeof(Control_block), false);
+
+            // New objects start gray during incremental marking. The caller may store a white object's only reference in it,
+            // and the new object won't get a write barrier for that first store.
+            // During a lazy sweep, new objects are marked so they won't look dead. The end of the sweep clears them with the rest.
+            Pool_allocator::set_marked(control_block, sizeof(Control_block), false);
+            if (incremental_marking_) {
+                mark(*control_block);
+            } else if (sweeping_) {
+                Pool_allocator::set_marked(control_block, sizeof(Control_block), true);
+            }
+
+            return GC_ptr<User_value_type>{control_block};
         }
 
         // Mark as reachable, and queue to trace references.
         void mark(GC_control_block_base&);
 
+        // Whether the object is marked in the current or most recent marking, and whether its references were traced during incremental marking.
+        // Marked but not yet traced is gray, and marked and traced is black.
+        bool marked(const GC_control_block_base&) const;
+        bool traced(const GC_control_block_base&) const;
+
+        // Call before storing a reference into an object. If the object is old, then the next young collection
+        // will trace its references as though it were a root. If the object is black during incremental marking,
+        // then it goes back to gray to be traced again, so a black object never refers to a white one.
+        void write_barrier(GC_control_block_base& control_block)
+        {
+            if (control_block.old && ! control_block.remembered) {
+                control_block.remembered = true;
+                remembered_set_.push_back(&control_block);
+            }
+
+            if (incremental_marking_ && Pool_allocator::traced(&control_block, control_block.size())) {
+                Pool_allocator::set_traced(&control_block, control_block.size(), false);
+                gray_worklist_.push_back(&control_block);
+            }
+        }
+
         // Mark all roots, trace all references, and delete anything that isn't reachable.
+        // If incremental marking is in progress, this finishes it.
         void collect_garbage();
 
-        // Report number of bytes allocated by this heap.
+        // Mark roots and remembered old objects, trace references only into young objects, and delete any young object that isn't reachable.
+        // Old objects are neither traced nor deleted, so the cost depends on what was allocated since the last collection.
+        // If incremental marking is in progress, this finishes the full collection instead.
+        void collect_young_garbage();
+
+        // Whether enough has been allocated since the last collection to collect again, or incremental marking or sweeping has work left.
+        bool collection_due() const
+        {
+            return incremental_marking_ || sweeping_ || n_young_bytes_ > nursery_size_ || over_limit();
+        }
+
+        // Whether more is allocated than the heap's limit allows.
+        bool over_limit() const
+        {
+            return max_heap_size_ != 0 && n_allocated_bytes_ > max_heap_size_;
+        }
+
+        // Whether a full collection has finished marking but not yet swept everything.
+        bool sweeping() const
+        {
+            return sweeping_;
+        }
+
+        // Whether the object was found unreachable and is waiting to be swept.
+        bool is_dead(const GC_control_block_base&) const;
+
+        // Whether the collection that just finished marking is young-only, and so whether a weak table need only check its young entries.
+        bool collecting_young_only() const
+        {
+            return collecting_young_only_;
+        }
+
+        // During `on_clear_weak_refs`, whether the object will outlive this collection.
+        // Old objects always survive a young collection.
+        bool survives(const GC_control_block_base& control_block) const
+        {
+            return (collecting_young_only_ && control_block.old) || Pool_allocator::marked(&control_block, control_block.size());
+        }
+
+        // Whether a full collection has started marking but not yet swept.
+        bool incremental_marking() const
+        {
+            return incremental_marking_;
+        }
+
+        // Whether the next collection should be full rather than young.
+        bool full_collection_due() const
+        {
+            return n_allocated_bytes_ > next_full_collect_size_;
+        }
+
+        // Run a full or young collection if one is due. With a mark slice budget, a full collection instead starts or continues
+        // incremental marking. A full collection's sweep is lazy, and continues a slice at a time on later calls.
+        // Over the heap limit, this instead runs a full collection to the end, and throws GC_heap_limit_error if that didn't free enough.
+        void collect_garbage_if_due();
+
+        // Report number of bytes allocated by this heap, including what objects own outside their control blocks.
         std::size_t size() const;
+
+        // Count more memory owned outside a live object's control block, which `owned_size_trait` will report from now on.
+        void add_owned_size(std::size_t);
+
+        // Report number of bytes allocated since the last collection.
+        std::size_t young_size() const;
+
+        // Report number of bytes taken from the system, including free blocks that only this heap can reuse.
+        std::size_t reserved_size() const;
+
+        // Whether enough of the reserved memory is free, beyond the minimum heap size, to be worth compacting.
+        bool compaction_due() const;
+
+        // Run a full collection, then move every survivor into fresh pages packed together and release the old pages.
+        // Nothing may hold a GC_ptr outside the heap and the update roots callbacks, so this is for when no code is running,
+        // such as between REPL lines. If moving an object throws, such as when copying a string runs out of memory, this terminates.
+        void compact();
+
+        GC_stats stats() const;
+
+        // Where an object moved to during compaction. Only valid from update roots callbacks and update refs traits.
+        GC_control_block_base* forwarding_address(const GC_control_block_base&) const;
     };
 
     template<typename User_value_type>
@@ -151,6 +728,31 @@ namespace motts::lox
             gc_heap.mark(*gc_ptr.control_block);
         }
     }
+
+    // Where the pointee moved to during compaction.
+    template<typename User_value_type>
+    GC_ptr<User_value_type> forwarded(GC_heap& gc_heap, GC_ptr<User_value_type> gc_ptr)
+    {
+        if (! gc_ptr) {
+            return gc_ptr;
+        }
+
+        return GC_ptr<User_value_type>{static_cast<GC_control_block<User_value_type>*>(gc_heap.forwarding_address(*gc_ptr.control_block))};
+    }
+
+    template<typename User_value_type>
+    void update_ref(GC_heap& gc_heap, GC_ptr<User_value_type>& gc_ptr)
+    {
+        gc_ptr = forwarded(gc_heap, gc_ptr);
+    }
+
+    template<typename User_value_type>
+    void write_barrier(GC_heap& gc_heap, GC_ptr<User_value_type> gc_ptr)
+    {
+        if (gc_ptr) {
+            gc_heap.write_barrier(*gc_ptr.control_block);
+        }
+    }
 }
 
 // The hash of GC_ptrs is the hash of the underlying control block pointers.
@@ -8,5 +8,7 @@ namespace motts::lox
     struct Function;
     struct Instance;
     struct Native_fn;
+    struct Shape;
+    class String;
     class Upvalue;
 }
@@ -9,8 +9,16 @@ namespace motts::lox
         mark(gc_heap, bound_method.method);
     }
 
-    Class::Class(GC_ptr<const std::string> name_arg)
-        : name{name_arg}
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Bound_method& bound_method)
+    {
+        update_ref(gc_heap, bound_method.instance);
+        update_ref(gc_heap, bound_method.method);
+    }
+
+    Class::Class(GC_ptr<const String> name_arg, GC_ptr<Shape> instance_shape_arg)
+        : name{name_arg},
+          instance_shape{instance_shape_arg}
     {
     }
 
@@ -22,6 +30,22 @@ namespace motts::lox
             mark(gc_heap, key);
             mark(gc_heap, method);
         }
+        mark(gc_heap, klass.instance_shape);
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Class& klass)
+    {
+        update_ref(gc_heap, klass.name);
+
+        // The methods are keyed by address, so rehash them under the new addresses.
+        decltype(klass.methods) methods;
+        for (const auto& [key, method] : klass.methods) {
+            methods.emplace(forwarded(gc_heap, key), forwarded(gc_heap, method));
+        }
+        klass.methods = std::move(methods);
+
+        update_ref(gc_heap, klass.instance_shape);
     }
 
     Closure::Closure(GC_ptr<Function> function_arg)
@@ -36,8 +60,14 @@ namespace motts::lox
         for (const auto& upvalue : closure.upvalues) {
             mark(gc_heap, upvalue);
         }
-        for (const auto& upvalue : closure.open_upvalues) {
-            mark(gc_heap, upvalue);
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Closure& closure)
+    {
+        update_ref(gc_heap, closure.function);
+        for (auto& upvalue : closure.upvalues) {
+            update_ref(gc_heap, upvalue);
         }
     }
 
@@ -46,28 +76,193 @@ namespace motts::lox
     {
         mark(gc_heap, function.name);
         for (const auto& value : function.chunk.constants()) {
-            std::visit(Mark_objects_visitor{gc_heap}, value);
+            visit_value(Mark_objects_visitor{gc_heap}, value);
         }
         for (const auto& source_map_token : function.chunk.source_map_tokens()) {
             mark(gc_heap, source_map_token.lexeme);
         }
+
+        // A cached shape must stay alive, or else a new shape could be allocated at the same address and falsely hit.
+        for (const auto& inline_cache : function.chunk.inline_caches()) {
+            mark(gc_heap, inline_cache.shape);
+            mark(gc_heap, inline_cache.next_shape);
+            mark(gc_heap, inline_cache.method);
+        }
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Function& function)
+    {
+        update_ref(gc_heap, function.name);
+        function.chunk.update_refs(gc_heap);
     }
 
     Instance::Instance(GC_ptr<Class> klass_arg)
-        : klass{klass_arg}
+        : klass{klass_arg},
+          shape{klass_arg->instance_shape}
+    {
+    }
+
+    const Dynamic_type_value* Instance::find_field(GC_ptr<const String> field_name) const
+    {
+        const auto maybe_slot_iter = shape->slot_indexes.find(field_name);
+        if (maybe_slot_iter == shape->slot_indexes.cend()) {
+            return nullptr;
+        }
+
+        return &fields[maybe_slot_iter->second];
+    }
+
+    void Instance::set_field(GC_heap& gc_heap, GC_ptr<const String> field_name, Dynamic_type_value value)
     {
+        const auto maybe_slot_iter = shape->slot_indexes.find(field_name);
+        if (maybe_slot_iter != shape->slot_indexes.cend()) {
+            fields[maybe_slot_iter->second] = value;
+            return;
+        }
+
+        write_barrier(gc_heap, shape);
+        auto& next_shape = shape->transitions[field_name];
+        if (! next_shape) {
+            Shape new_shape{shape->slot_indexes, {}};
+            new_shape.slot_indexes.emplace(field_name, fields.size());
+            next_shape = gc_heap.make(std::move(new_shape));
+        }
+
+        shape = next_shape;
+        fields.push_back(value);
     }
 
     template<>
     void trace_refs_trait(GC_heap& gc_heap, const Instance& instance)
     {
         mark(gc_heap, instance.klass);
-        for (const auto& [key, field] : instance.fields) {
+        mark(gc_heap, instance.shape);
+        for (const auto& field : instance.fields) {
+            visit_value(Mark_objects_visitor{gc_heap}, field);
+        }
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Instance& instance)
+    {
+        update_ref(gc_heap, instance.klass);
+        update_ref(gc_heap, instance.shape);
+        for (auto& field : instance.fields) {
+            update_ref(gc_heap, field);
+        }
+    }
+
+    template<>
+    void trace_refs_trait(GC_heap& gc_heap, const Shape& shape)
+    {
+        for (const auto& [key, slot_index] : shape.slot_indexes) {
             mark(gc_heap, key);
-            std::visit(Mark_objects_visitor{gc_heap}, field);
+        }
+        for (const auto& [key, next_shape] : shape.transitions) {
+            mark(gc_heap, key);
+            mark(gc_heap, next_shape);
         }
     }
 
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Shape& shape)
+    {
+        // Both maps are keyed by address, so rehash them under the new addresses.
+        decltype(shape.slot_indexes) slot_indexes;
+        for (const auto& [key, slot_index] : shape.slot_indexes) {
+            slot_indexes.emplace(forwarded(gc_heap, key), slot_index);
+        }
+        shape.slot_indexes = std::move(slot_indexes);
+
+        decltype(shape.transitions) transitions;
+        for (const auto& [key, next_shape] : shape.transitions) {
+            transitions.emplace(forwarded(gc_heap, key), forwarded(gc_heap, next_shape));
+        }
+        shape.transitions = std::move(transitions);
+    }
+
+    String::String(std::string&& chars, std::size_t hash)
+        : chars_{std::move(chars)},
+          length_{chars_.size()},
+          hash_{hash},
+          interned_{true}
+    {
+    }
+
+    String::String(GC_heap& gc_heap, GC_ptr<const String> left, GC_ptr<const String> right)
+        : length_{left->length() + right->length()},
+          left_{left},
+          right_{right},
+          gc_heap_{&gc_heap}
+    {
+    }
+
+    std::size_t String::hash_chars(std::string_view chars)
+    {
+        return std::hash<std::string_view>{}(chars);
+    }
+
+    const std::string& String::chars() const
+    {
+        if (left_) {
+            // Ropes built in a loop are as deep as the loop is long, so walk them with a worklist rather than recursion.
+            std::string chars;
+            chars.reserve(length_);
+
+            std::vector<GC_ptr<const String>> pending{right_, left_};
+            while (! pending.empty()) {
+                const auto str = pending.back();
+                pending.pop_back();
+
+                if (str->left_) {
+                    pending.push_back(str->right_);
+                    pending.push_back(str->left_);
+                } else {
+                    chars += str->chars_;
+                }
+            }
+
+            chars_ = std::move(chars);
+            left_ = {};
+            right_ = {};
+
+            // Only now does the rope own its characters. Charging them when it was made would count each character
+            // once for every rope above it, and a string built by appending keeps every one of those ropes alive.
+            gc_heap_->add_owned_size(chars_.size());
+        }
+
+        return chars_;
+    }
+
+    template<>
+    void trace_refs_trait(GC_heap& gc_heap, const String& str)
+    {
+        mark(gc_heap, str.left_);
+        mark(gc_heap, str.right_);
+        mark(gc_heap, str.canonical_);
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, const String& str)
+    {
+        update_ref(gc_heap, str.left_);
+        update_ref(gc_heap, str.right_);
+        update_ref(gc_heap, str.canonical_);
+    }
+
+    template<>
+    std::size_t owned_size_trait(const String& str)
+    {
+        return str.chars_.size();
+    }
+
+    std::ostream& operator<<(std::ostream& os, const String& str)
+    {
+        os << str.chars();
+        return os;
+    }
+
     Upvalue::Upvalue(std::vector<Dynamic_type_value>& stack_arg, std::size_t stack_index_arg)
         : value_{Open{stack_arg, stack_index_arg}}
     {
@@ -78,6 +273,11 @@ namespace motts::lox
         value_ = Closed{value()};
     }
 
+    bool Upvalue::closed() const
+    {
+        return std::holds_alternative<Closed>(value_);
+    }
+
     std::size_t Upvalue::stack_index() const
     {
         return std::get<Open>(value_).stack_index;
@@ -101,6 +301,15 @@ namespace motts::lox
     template<>
     void trace_refs_trait(GC_heap& gc_heap, const Upvalue& upvalue)
     {
-        std::visit(Mark_objects_visitor{gc_heap}, upvalue.value());
+        visit_value(Mark_objects_visitor{gc_heap}, upvalue.value());
+    }
+
+    template<>
+    void update_refs_trait(GC_heap& gc_heap, Upvalue& upvalue)
+    {
+        // An open upvalue's value is a stack slot, which the VM updates as a root.
+        if (upvalue.closed()) {
+            update_ref(gc_heap, upvalue.value());
+        }
     }
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <ostream>
 #include <span>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 
@@ -19,34 +22,43 @@ namespace motts::lox
     template<>
     void trace_refs_trait(GC_heap&, const Bound_method&);
 
+    template<>
+    void update_refs_trait(GC_heap&, Bound_method&);
+
     struct Class
     {
-        GC_ptr<const std::string> name;
-        std::unordered_map<GC_ptr<const std::string>, GC_ptr<Closure>> methods;
+        GC_ptr<const String> name;
+        std::unordered_map<GC_ptr<const String>, GC_ptr<Closure>> methods;
 
-        Class(GC_ptr<const std::string> name);
+        // The shape of a new instance before any fields are set. Every instance shape of this class descends from it.
+        GC_ptr<Shape> instance_shape;
+
+        Class(GC_ptr<const String> name, GC_ptr<Shape> instance_shape);
     };
 
     template<>
     void trace_refs_trait(GC_heap&, const Class&);
 
+    template<>
+    void update_refs_trait(GC_heap&, Class&);
+
     struct Closure
     {
         GC_ptr<Function> function;
         std::vector<GC_ptr<Upvalue>> upvalues;
 
-        // Following Lua, we’ll use "open upvalue" to refer to an upvalue that points to a local variable still on the stack.
-        std::vector<GC_ptr<Upvalue>> open_upvalues;
-
         Closure(GC_ptr<Function>);
     };
 
     template<>
     void trace_refs_trait(GC_heap&, const Closure&);
 
+    template<>
+    void update_refs_trait(GC_heap&, Closure&);
+
     struct Function
     {
-        GC_ptr<const std::string> name;
+        GC_ptr<const String> name;
         unsigned int arity{0};
         Chunk chunk;
     };
@@ -54,22 +66,123 @@ namespace motts::lox
     template<>
     void trace_refs_trait(GC_heap&, const Function&);
 
+    template<>
+    void update_refs_trait(GC_heap&, Function&);
+
     struct Instance
     {
         GC_ptr<Class> klass;
-        std::unordered_map<GC_ptr<const std::string>, Dynamic_type_value> fields;
+
+        // Field names and slot indexes live in the shared shape, so each instance stores only its field values, in slot order.
+        GC_ptr<Shape> shape;
+        std::vector<Dynamic_type_value> fields;
 
         Instance(GC_ptr<Class>);
+
+        // Returns null if the instance has no such field.
+        const Dynamic_type_value* find_field(GC_ptr<const String> field_name) const;
+
+        // Adding a new field moves the instance to the next shape, which may need to be allocated.
+        void set_field(GC_heap&, GC_ptr<const String> field_name, Dynamic_type_value);
     };
 
     template<>
     void trace_refs_trait(GC_heap&, const Instance&);
 
+    template<>
+    void update_refs_trait(GC_heap&, Instance&);
+
     struct Native_fn
     {
         Dynamic_type_value (*fn)(std::span<Dynamic_type_value> args);
     };
 
+    // A hidden class. Instances that gain the same fields in the same order share a shape,
+    // which maps each field name to a slot in the instance's field values.
+    struct Shape
+    {
+        std::unordered_map<GC_ptr<const String>, std::size_t> slot_indexes;
+
+        // Adding a field to an instance of this shape leads to the shape stored here under that field name.
+        std::unordered_map<GC_ptr<const String>, GC_ptr<Shape>> transitions;
+    };
+
+    template<>
+    void trace_refs_trait(GC_heap&, const Shape&);
+
+    template<>
+    void update_refs_trait(GC_heap&, Shape&);
+
+    // An immutable Lox string. An interned string's hash is computed once, when it's made,
+    // so interning never reads the characters of an existing string to hash them again.
+    //
+    // Concatenating long strings makes a rope instead, which only points to its two halves, so building a string piece by piece
+    // isn't quadratic. A rope is flattened the first time its characters are read, and interned the first time it's compared.
+    // It then either is the interned string, or forwards to the equal string that was interned first.
+    class String
+    {
+        mutable std::string chars_;
+        std::size_t length_;
+
+        // The halves of a rope that hasn't been flattened yet.
+        mutable GC_ptr<const String> left_;
+        mutable GC_ptr<const String> right_;
+
+        // Only for a rope. Flattening charges the new characters to this heap.
+        GC_heap* gc_heap_{};
+
+        mutable std::size_t hash_{0};
+        mutable bool interned_{false};
+        mutable GC_ptr<const String> canonical_;
+
+        friend class Interned_strings;
+        friend void trace_refs_trait<String>(GC_heap&, const String&);
+        friend void update_refs_trait<const String>(GC_heap&, const String&);
+        friend std::size_t owned_size_trait<String>(const String&);
+
+      public:
+        // Only the intern table makes flat strings. The hash must be `String::hash_chars(chars)`.
+        // It's passed in because the intern table hashes before deciding to make a string.
+        String(std::string&& chars, std::size_t hash);
+
+        // A rope of the two strings joined.
+        String(GC_heap&, GC_ptr<const String> left, GC_ptr<const String> right);
+
+        static std::size_t hash_chars(std::string_view);
+
+        // Flattens a rope first.
+        const std::string& chars() const;
+
+        std::size_t length() const
+        {
+            return length_;
+        }
+
+        // Whether this is the string in the intern table for its characters, and so equal to another interned string
+        // only if it's the same object. Only interned strings have a hash.
+        bool interned() const
+        {
+            return interned_;
+        }
+
+        std::size_t hash() const
+        {
+            return hash_;
+        }
+    };
+
+    template<>
+    void trace_refs_trait(GC_heap&, const String&);
+
+    template<>
+    void update_refs_trait(GC_heap&, const String&);
+
+    // A string's characters count toward the heap's size. A rope's count only once it's flattened.
+    template<>
+    std::size_t owned_size_trait(const String&);
+
+    std::ostream& operator<<(std::ostream&, const String&);
+
     class Upvalue
     {
         struct Open
@@ -91,6 +204,7 @@ namespace motts::lox
         Upvalue(std::vector<Dynamic_type_value>& stack, std::size_t stack_index);
 
         void close();
+        bool closed() const;
         std::size_t stack_index() const;
         const Dynamic_type_value& value() const;
         Dynamic_type_value& value();
@@ -98,4 +212,7 @@ namespace motts::lox
 
     template<>
     void trace_refs_trait(GC_heap&, const Upvalue&);
+
+    template<>
+    void update_refs_trait(GC_heap&, Upvalue&);
 }
@@ -30,7 +30,7 @@ namespace motts::lox
 
         auto operator()(GC_ptr<Function> fn)
         {
-            os << "<fn " << (! fn->name || fn->name->empty() ? "(anonymous)" : *fn->name) << '>';
+            os << "<fn " << (! fn->name || fn->name->chars().empty() ? "(anonymous)" : fn->name->chars()) << '>';
         }
 
         auto operator()(GC_ptr<Bound_method> bound_method)
@@ -58,7 +58,7 @@ namespace motts::lox
             os << "<native fn>";
         }
 
-        auto operator()(GC_ptr<const std::string> str)
+        auto operator()(GC_ptr<const String> str)
         {
             os << *str;
         }
@@ -66,7 +66,35 @@ namespace motts::lox
 
     std::ostream& operator<<(std::ostream& os, Dynamic_type_value value)
     {
-        std::visit(Print_visitor{os}, value);
+        visit_value(Print_visitor{os}, value);
         return os;
     }
+
+    struct Update_ref_visitor
+    {
+        GC_heap& gc_heap;
+
+        Update_ref_visitor(GC_heap& gc_heap_arg)
+            : gc_heap{gc_heap_arg}
+        {
+        }
+
+        template<typename T>
+        Dynamic_type_value operator()(GC_ptr<T> object_type)
+        {
+            update_ref(gc_heap, object_type);
+            return object_type;
+        }
+
+        template<typename T>
+        Dynamic_type_value operator()(T value)
+        {
+            return value;
+        }
+    };
+
+    void update_ref(GC_heap& gc_heap, Dynamic_type_value& value)
+    {
+        value = visit_value(Update_ref_visitor{gc_heap}, value);
+    }
 }
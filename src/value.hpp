@@ -1,6 +1,12 @@
 #pragma once
 
+#include <bit>
+#include <cassert>
+#include <concepts>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <variant>
 
 #include "memory.hpp"
@@ -8,6 +14,7 @@
 
 namespace motts::lox
 {
+#ifndef MOTTS_LOX_NAN_BOXING
     // This variant will be the size of two CPU words and is safe to pass around by value.
     using Dynamic_type_value = std::variant<
         // `nullptr_t` should be first so it will be picked as the default constructed value.
@@ -25,10 +32,234 @@ namespace motts::lox
         GC_ptr<Function>,
         GC_ptr<Instance>,
         GC_ptr<Native_fn>,
-        GC_ptr<const std::string>>;
+        GC_ptr<const String>>;
+
+    // Both value representations share this small access API, so the rest of the code doesn't care which one is built.
+    // The optional is empty if the value holds some other type.
+    template<typename T>
+    std::optional<T> try_as(const Dynamic_type_value& value)
+    {
+        if (const auto* maybe_value = std::get_if<T>(&value)) {
+            return *maybe_value;
+        }
+
+        return std::nullopt;
+    }
+
+    // Throws std::bad_variant_access if the value holds some other type.
+    template<typename T>
+    T as(const Dynamic_type_value& value)
+    {
+        return std::get<T>(value);
+    }
+
+    template<typename Visitor>
+    decltype(auto) visit_value(Visitor&& visitor, const Dynamic_type_value& value)
+    {
+        return std::visit(std::forward<Visitor>(visitor), value);
+    }
+#else
+    // Which object type a NaN-boxed pointer refers to. Three tag bits fit inside the quiet NaN space,
+    // and tag 0 is reserved for the nil/false/true singletons.
+    template<typename>
+    struct Nan_box_tag;
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Bound_method>>
+    {
+        static constexpr std::uint64_t value{1};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Class>>
+    {
+        static constexpr std::uint64_t value{2};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Closure>>
+    {
+        static constexpr std::uint64_t value{3};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Function>>
+    {
+        static constexpr std::uint64_t value{4};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Instance>>
+    {
+        static constexpr std::uint64_t value{5};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<Native_fn>>
+    {
+        static constexpr std::uint64_t value{6};
+    };
+
+    template<>
+    struct Nan_box_tag<GC_ptr<const String>>
+    {
+        static constexpr std::uint64_t value{7};
+    };
+
+    // A one CPU word value. Any double is stored as its own bits. Everything else is stored as a negative quiet NaN,
+    // with a type tag in bits 48-50 and a 48-bit pointer or singleton in the low bits. Checking a type is then one mask and compare.
+    class Dynamic_type_value
+    {
+        static constexpr std::uint64_t box_mask{0xfff8'0000'0000'0000};
+        static constexpr std::uint64_t tag_mask{0xffff'0000'0000'0000};
+        static constexpr std::uint64_t payload_mask{0x0000'ffff'ffff'ffff};
+        static constexpr std::uint64_t tag_shift{48};
+
+        static constexpr std::uint64_t nil_bits{box_mask | 1};
+        static constexpr std::uint64_t false_bits{box_mask | 2};
+        static constexpr std::uint64_t true_bits{box_mask | 3};
+
+        // Arithmetic can produce a NaN with the sign bit set, which would look like a boxed value, so all NaNs are stored as this one.
+        static constexpr std::uint64_t canonical_nan_bits{0x7ff8'0000'0000'0000};
+
+        std::uint64_t bits_{nil_bits};
+
+        template<typename T>
+        static constexpr std::uint64_t box_tag_bits()
+        {
+            return box_mask | (Nan_box_tag<T>::value << tag_shift);
+        }
+
+      public:
+        Dynamic_type_value() = default;
+
+        Dynamic_type_value(std::nullptr_t)
+        {
+        }
+
+        // A template so that pointers and integers won't silently convert to bool.
+        template<typename T>
+            requires std::same_as<T, bool>
+        Dynamic_type_value(T value)
+            : bits_{value ? true_bits : false_bits}
+        {
+        }
+
+        Dynamic_type_value(double value)
+            : bits_{value != value ? canonical_nan_bits : std::bit_cast<std::uint64_t>(value)}
+        {
+        }
+
+        template<typename User_value_type>
+        Dynamic_type_value(GC_ptr<User_value_type> gc_ptr)
+            : bits_{box_tag_bits<GC_ptr<User_value_type>>() | reinterpret_cast<std::uintptr_t>(gc_ptr.control_block)}
+        {
+            assert((reinterpret_cast<std::uintptr_t>(gc_ptr.control_block) & ~payload_mask) == 0 && "Expect 48-bit pointers.");
+        }
+
+        template<typename T>
+        bool holds() const
+        {
+            if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                return bits_ == nil_bits;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return (bits_ & ~std::uint64_t{1}) == false_bits;
+            } else if constexpr (std::is_same_v<T, double>) {
+                return (bits_ & box_mask) != box_mask;
+            } else {
+                return (bits_ & tag_mask) == box_tag_bits<T>();
+            }
+        }
+
+        // Caller must check `holds<T>` first.
+        template<typename T>
+        T unchecked_get() const
+        {
+            if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                return nullptr;
+            } else if constexpr (std::is_same_v<T, bool>) {
+                return bits_ == true_bits;
+            } else if constexpr (std::is_same_v<T, double>) {
+                return std::bit_cast<double>(bits_);
+            } else {
+                return T{reinterpret_cast<decltype(T::control_block)>(bits_ & payload_mask)};
+            }
+        }
+
+        // Numbers compare by numeric value, so NaN != NaN and 0 == -0. Everything else is the same value only if it's the same bits.
+        friend bool operator==(Dynamic_type_value lhs, Dynamic_type_value rhs)
+        {
+            if (lhs.holds<double>() && rhs.holds<double>()) {
+                return lhs.unchecked_get<double>() == rhs.unchecked_get<double>();
+            }
+
+            return lhs.bits_ == rhs.bits_;
+        }
+
+        template<typename Visitor>
+        friend decltype(auto) visit_value(Visitor&& visitor, Dynamic_type_value value)
+        {
+            if (value.holds<double>()) {
+                return visitor(value.unchecked_get<double>());
+            }
+
+            switch ((value.bits_ & tag_mask) >> tag_shift & 0b111) {
+                default:
+                    return value.bits_ == nil_bits ? visitor(nullptr) : visitor(value.unchecked_get<bool>());
+
+                case Nan_box_tag<GC_ptr<Bound_method>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Bound_method>>());
+
+                case Nan_box_tag<GC_ptr<Class>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Class>>());
+
+                case Nan_box_tag<GC_ptr<Closure>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Closure>>());
+
+                case Nan_box_tag<GC_ptr<Function>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Function>>());
+
+                case Nan_box_tag<GC_ptr<Instance>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Instance>>());
+
+                case Nan_box_tag<GC_ptr<Native_fn>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<Native_fn>>());
+
+                case Nan_box_tag<GC_ptr<const String>>::value:
+                    return visitor(value.unchecked_get<GC_ptr<const String>>());
+            }
+        }
+    };
+
+    static_assert(sizeof(Dynamic_type_value) == 8);
+
+    template<typename T>
+    std::optional<T> try_as(Dynamic_type_value value)
+    {
+        if (value.holds<T>()) {
+            return value.unchecked_get<T>();
+        }
+
+        return std::nullopt;
+    }
+
+    // Throws std::bad_variant_access if the value holds some other type, same as the variant representation.
+    template<typename T>
+    T as(Dynamic_type_value value)
+    {
+        if (! value.holds<T>()) {
+            throw std::bad_variant_access{};
+        }
+
+        return value.unchecked_get<T>();
+    }
+#endif
 
     std::ostream& operator<<(std::ostream&, Dynamic_type_value);
 
+    // After compaction, point the value at where its object moved to, if it holds an object.
+    void update_ref(GC_heap&, Dynamic_type_value&);
+
     struct Is_truthy_visitor
     {
         auto operator()(std::nullptr_t) const
@@ -11,6 +11,9 @@
 
 namespace motts::lox
 {
+    // A null native fn can't be made from Lox, so it's free to mark a global slot as not yet defined.
+    static const Dynamic_type_value undefined_global{GC_ptr<Native_fn>{}};
+
     static Dynamic_type_value clock_native(std::span<Dynamic_type_value>)
     {
         const auto now_time_point = std::chrono::system_clock::now().time_since_epoch();
@@ -18,35 +21,173 @@ namespace motts::lox
         return gsl::narrow<double>(now_seconds);
     }
 
-    VM::VM(GC_heap& gc_heap, Interned_strings& interned_strings, std::ostream& os, bool debug)
+    // Shorter concatenations are interned right away. They're cheap to hash, and then they compare by pointer.
+    static constexpr std::size_t min_rope_length{64};
+
+    // Two different string objects can still be equal if either is a rope, which is interned to be compared.
+    // Kept out of line, so the equality handler stays small.
+    [[gnu::noinline]] static bool strings_equal(Interned_strings& interned_strings, const Dynamic_type_value& lhs, const Dynamic_type_value& rhs)
+    {
+        const auto maybe_string_lhs = try_as<GC_ptr<const String>>(lhs);
+        const auto maybe_string_rhs = try_as<GC_ptr<const String>>(rhs);
+        if (! maybe_string_lhs || ! maybe_string_rhs || ((*maybe_string_lhs)->interned() && (*maybe_string_rhs)->interned())) {
+            return false;
+        }
+
+        return interned_strings.intern(*maybe_string_lhs) == interned_strings.intern(*maybe_string_rhs);
+    }
+
+    VM::VM(GC_heap& gc_heap, Interned_strings& interned_strings, std::ostream& os, bool debug, std::size_t max_call_frames)
         : debug_{debug},
+          max_call_frames_{max_call_frames},
           os_{os},
           gc_heap_{gc_heap},
           interned_strings_{interned_strings}
     {
         gc_heap_.on_mark_roots.push_back([this] {
-            for (const auto& closure : call_frames_) {
-                mark(gc_heap_, closure);
+            for (const auto& call_frame : call_frames_) {
+                mark(gc_heap_, call_frame.closure);
             }
 
             for (const auto& value : stack_) {
-                std::visit(Mark_objects_visitor{gc_heap_}, value);
+                visit_value(Mark_objects_visitor{gc_heap_}, value);
+            }
+
+            for (const auto& value : globals_) {
+                visit_value(Mark_objects_visitor{gc_heap_}, value);
+            }
+
+            for (const auto& upvalue : open_upvalues_) {
+                mark(gc_heap_, upvalue);
+            }
+        });
+
+        gc_heap_.on_update_roots.push_back([this] {
+            for (auto& call_frame : call_frames_) {
+                update_ref(gc_heap_, call_frame.closure);
+            }
+
+            for (auto& value : stack_) {
+                update_ref(gc_heap_, value);
+            }
+
+            for (auto& value : globals_) {
+                update_ref(gc_heap_, value);
             }
 
-            for (const auto& [key, value] : globals_) {
-                mark(gc_heap_, key);
-                std::visit(Mark_objects_visitor{gc_heap_}, value);
+            for (auto& upvalue : open_upvalues_) {
+                update_ref(gc_heap_, upvalue);
             }
         });
 
-        globals_[interned_strings_.get("clock")] = gc_heap_.make<Native_fn>({clock_native});
+        const auto clock_slot_index = interned_strings_.global_slot_index(interned_strings_.get("clock"));
+        globals_.resize(interned_strings_.n_global_slots(), undefined_global);
+        globals_[clock_slot_index] = gc_heap_.make<Native_fn>({clock_native});
     }
 
     VM::~VM()
     {
+        gc_heap_.on_update_roots.pop_back();
         gc_heap_.on_mark_roots.pop_back();
     }
 
+    void VM::close_upvalues(std::size_t stack_begin_index)
+    {
+        while (! open_upvalues_.empty() && open_upvalues_.back()->stack_index() >= stack_begin_index) {
+            write_barrier(gc_heap_, open_upvalues_.back());
+            open_upvalues_.back()->close();
+            open_upvalues_.pop_back();
+        }
+    }
+
+    void VM::collect_garbage_if_needed(const Source_map_token& token)
+    {
+        // The heap decides when a collection is due. This is called only at safe points,
+        // after an allocating opcode has put its new object where the roots can reach it.
+        if (gc_heap_.collection_due()) {
+            // A full collection may span many calls, while it marks or sweeps incrementally.
+            if (! gc_heap_.incremental_marking() && ! gc_heap_.sweeping()) {
+                gc_heap_size_before_collect_ = gc_heap_.size();
+                gc_collect_is_full_ = gc_heap_.full_collection_due();
+            }
+
+            try {
+                gc_heap_.collect_garbage_if_due();
+            } catch (const GC_heap_limit_error&) {
+                std::ostringstream os;
+                os << "[Line " << token.line << "] Error at \"" << *token.lexeme << "\": Out of memory.";
+                throw std::runtime_error{os.str()};
+            }
+
+            if (debug_ && ! gc_heap_.incremental_marking() && ! gc_heap_.sweeping()) {
+                os_ << (gc_collect_is_full_ ? "# Collecting garbage: " : "# Collecting young garbage: ") << gc_heap_size_before_collect_
+                    << " bytes -> " << gc_heap_.size() << '\n';
+            }
+        }
+    }
+
+    const Inline_cache_stats& VM::inline_cache_stats() const
+    {
+        return inline_cache_stats_;
+    }
+
+    std::ostream& operator<<(std::ostream& os, const Inline_cache_stats& stats)
+    {
+        const auto print_counts = [&](const char* opcode_name, const Inline_cache_stats::Counts& counts) {
+            os << "    " << std::setw(12) << std::left << opcode_name << " : " << counts.hits << " hits, " << counts.misses << " misses\n";
+        };
+
+        os << "# Inline caches:\n";
+        print_counts("GET_PROPERTY", stats.get_property);
+        print_counts("SET_PROPERTY", stats.set_property);
+        print_counts("INVOKE", stats.invoke);
+
+        return os;
+    }
+
+    void VM::dump_stack() const
+    {
+        os_ << "# Stack:\n";
+        for (auto stack_iter = stack_.crbegin(); stack_iter != stack_.crend(); ++stack_iter) {
+            const auto stack_index = stack_iter.base() - 1 - stack_.cbegin();
+            os_ << std::setw(5) << std::setfill(' ') << std::right << stack_index << " : " << *stack_iter << '\n';
+        }
+        os_ << '\n';
+    }
+
+// Every opcode handler ends by dispatching the next opcode. With the switch, that means going back around the loop.
+// With threaded dispatch, each handler fetches and jumps to the next handler directly through `opcode_labels`,
+// which gives the CPU a separate indirect branch to predict per handler rather than one shared by every opcode.
+// Dispatching also ends any wide prefix, which the wide handler sets just before it fetches the opcode it applies to.
+#ifdef MOTTS_LOX_THREADED_DISPATCH
+#define MOTTS_LOX_OPCODE_CASE(name) \
+    case Opcode::name: \
+    opcode_##name:
+#define MOTTS_LOX_FETCH() \
+    if (bytecode_iter == bytecode->cend()) { \
+        continue; \
+    } \
+    opcode_iter = bytecode_iter; \
+    opcode = static_cast<Opcode>(*bytecode_iter++); \
+    goto* opcode_labels[static_cast<std::size_t>(opcode)]
+#define MOTTS_LOX_DISPATCH() \
+    wide = false; \
+    MOTTS_LOX_FETCH()
+#else
+#define MOTTS_LOX_OPCODE_CASE(name) case Opcode::name:
+#define MOTTS_LOX_FETCH() continue
+#define MOTTS_LOX_DISPATCH() \
+    wide = false; \
+    continue
+#endif
+
+// Most handlers dump the stack in debug mode. Calls that push a frame skip it, so the trace shows the callee's opcodes next.
+#define MOTTS_LOX_NEXT_OPCODE() \
+    if (debug_) { \
+        dump_stack(); \
+    } \
+    MOTTS_LOX_DISPATCH()
+
     void VM::run(GC_ptr<Function> function)
     {
         assert(! ! function && "Expect non-null.");
@@ -55,175 +196,331 @@ namespace motts::lox
             os_ << "\n# Running chunk:\n\n" << function->chunk << '\n';
         }
 
-        run(gc_heap_.make<Closure>(function), 0);
-    }
+        // If a runtime error unwinds us, then discard whatever frames, stack values, and open upvalues were still active
+        // so the next run starts clean. Otherwise, after an out of memory error, the stale stack would keep the garbage alive.
+        const auto call_frames_begin_size = call_frames_.size();
+        const auto stack_begin_size = stack_.size();
+        const auto _ = gsl::finally([&] {
+            call_frames_.erase(call_frames_.cbegin() + call_frames_begin_size, call_frames_.cend());
+            close_upvalues(stack_begin_size);
+            stack_.erase(stack_.cbegin() + stack_begin_size, stack_.cend());
+        });
 
-    void VM::run(GC_ptr<Closure> closure, std::size_t stack_begin_index)
-    {
-        call_frames_.push_back(closure);
-        const auto _ = gsl::finally([&] { call_frames_.pop_back(); });
+        // Compiling may have handed out new global slots since the last run.
+        globals_.resize(interned_strings_.n_global_slots(), undefined_global);
+
+        call_frames_.push_back({gc_heap_.make<Closure>(function), function->chunk.bytecode().cbegin(), 0});
+
+        // The current frame's hot state is cached in locals, and reloaded only when a call or return changes the frame.
+        const std::vector<std::uint8_t>* bytecode{};
+        const std::vector<Dynamic_type_value>* constants{};
+        const std::vector<std::size_t>* global_slot_indexes{};
+        const std::vector<Source_map_token>* source_map_tokens{};
+        const std::vector<std::uint32_t>* inline_cache_indexes{};
+        std::vector<Inline_cache>* inline_caches{};
+        std::vector<GC_ptr<Upvalue>>* upvalues{};
+        std::vector<std::uint8_t>::const_iterator bytecode_iter;
+        std::size_t stack_begin_index{0};
+
+        const auto load_call_frame = [&] {
+            auto& call_frame = call_frames_.back();
+            const auto& chunk = call_frame.closure->function->chunk;
+
+            bytecode = &chunk.bytecode();
+            constants = &chunk.constants();
+            global_slot_indexes = &chunk.global_slot_indexes();
+            source_map_tokens = &chunk.source_map_tokens();
+            inline_cache_indexes = &chunk.inline_cache_indexes();
+            inline_caches = &call_frame.closure->function->chunk.inline_caches();
+            upvalues = &call_frame.closure->upvalues;
+            bytecode_iter = call_frame.bytecode_iter;
+            stack_begin_index = call_frame.stack_begin_index;
+        };
+
+        const auto push_call_frame = [&](GC_ptr<Closure> closure, std::size_t callee_stack_begin_index, const Source_map_token& token) {
+            if (call_frames_.size() == max_call_frames_) {
+                std::ostringstream os;
+                os << "[Line " << token.line << "] Error at \"" << *token.lexeme << "\": Stack overflow.";
+                throw std::runtime_error{os.str()};
+            }
 
-        const auto& chunk = closure->function->chunk;
-        const auto& bytecode = chunk.bytecode();
-        const auto& constants = chunk.constants();
-        const auto& source_map_tokens = chunk.source_map_tokens();
+            call_frames_.back().bytecode_iter = bytecode_iter;
+            call_frames_.push_back({closure, closure->function->chunk.bytecode().cbegin(), callee_stack_begin_index});
+            load_call_frame();
+        };
+
+        // The current opcode and where it began. The source map token is looked up only when a handler needs it,
+        // which is almost always to report an error.
+        auto opcode = Opcode::constant;
+        auto opcode_iter = bytecode_iter;
+        const auto source_map_token = [&]() -> const Source_map_token& { return (*source_map_tokens)[opcode_iter - bytecode->cbegin()]; };
+        const auto inline_cache = [&]() -> Inline_cache& {
+            return (*inline_caches)[(*inline_cache_indexes)[opcode_iter - bytecode->cbegin()]];
+        };
+
+        // Operands are one byte and jump distances two, unless the opcode came after a wide prefix, which doubles both.
+        // That's rare, so the common case pays only for a well predicted branch.
+        auto wide = false;
+        const auto read_operand = [&]() -> std::size_t {
+            if (! wide) {
+                return *bytecode_iter++;
+            }
+
+            const auto operand_big_endian = reinterpret_cast<const std::uint16_t&>(*bytecode_iter);
+            bytecode_iter += 2;
+            return boost::endian::big_to_native(operand_big_endian);
+        };
+        const auto read_jump_distance = [&]() -> std::size_t {
+            if (! wide) {
+                const auto jump_distance_big_endian = reinterpret_cast<const std::uint16_t&>(*bytecode_iter);
+                bytecode_iter += 2;
+                return boost::endian::big_to_native(jump_distance_big_endian);
+            }
+
+            const auto jump_distance_big_endian = reinterpret_cast<const std::uint32_t&>(*bytecode_iter);
+            bytecode_iter += 4;
+            return boost::endian::big_to_native(jump_distance_big_endian);
+        };
+
+        // Looks up a property the slow way, and records in the cache where it was found.
+        const auto fill_property_cache = [&](Inline_cache& cache, GC_ptr<Instance> instance, GC_ptr<const String> property_name) {
+            // The cache lives in the function, which may be old.
+            write_barrier(gc_heap_, call_frames_.back().closure->function);
+
+            const auto maybe_slot_iter = instance->shape->slot_indexes.find(property_name);
+            if (maybe_slot_iter != instance->shape->slot_indexes.cend()) {
+                cache = {instance->shape, maybe_slot_iter->second, {}, {}};
+                return;
+            }
+
+            const auto maybe_method_iter = instance->klass->methods.find(property_name);
+            if (maybe_method_iter == instance->klass->methods.cend()) {
+                throw std::runtime_error{
+                    "[Line " + std::to_string(source_map_token().line) + "] Error: Undefined property \"" + property_name->chars()
+                    + "\"."};
+            }
+
+            cache = {instance->shape, 0, {}, maybe_method_iter->second};
+        };
+
+        // Calls a closure whose callee slot (or "this" slot) and arguments are already on the stack.
+        const auto call_closure = [&](GC_ptr<Closure> closure, std::size_t arg_count) {
+            if (closure->function->arity != arg_count) {
+                std::ostringstream os;
+                os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme << "\": "
+                   << "Expected " << closure->function->arity << " arguments but got " << arg_count << '.';
+                throw std::runtime_error{os.str()};
+            }
+
+            push_call_frame(closure, stack_.size() - arg_count - 1, source_map_token());
+        };
+
+        // Calls whatever value sits below the arguments. Returns true if that pushed a call frame,
+        // in which case the handler should dispatch without dumping the stack.
+        const auto call_value = [&](Dynamic_type_value maybe_callable, std::size_t arg_count) {
+            if (const auto maybe_closure = try_as<GC_ptr<Closure>>(maybe_callable)) {
+                call_closure(*maybe_closure, arg_count);
+                return true;
+            }
+
+            if (const auto maybe_class = try_as<GC_ptr<Class>>(maybe_callable)) {
+                const auto klass = *maybe_class;
+                const auto maybe_init_iter = klass->methods.find(interned_strings_.get("init"));
+                const auto arity = maybe_init_iter != klass->methods.cend() ? maybe_init_iter->second->function->arity : 0;
+
+                if (arity != arg_count) {
+                    std::ostringstream os;
+                    os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme << "\": "
+                       << "Expected " << arity << " arguments but got " << arg_count << '.';
+                    throw std::runtime_error{os.str()};
+                }
+
+                // If there's no init method, then we'd pop the class and push the instance,
+                // so assigning the instance into the class slot has the same effect.
+                // But if there's an init method, then we need to prepare the stack like a bound method,
+                // which means putting the "this" instance in the class slot before the arguments.
+                // Either way, the instance ends up in the same slot where the class was.
+                *(stack_.end() - arg_count - 1) = gc_heap_.make<Instance>({klass});
+                collect_garbage_if_needed(source_map_token());
+
+                if (maybe_init_iter != klass->methods.cend()) {
+                    push_call_frame(maybe_init_iter->second, stack_.size() - arg_count - 1, source_map_token());
+                    return true;
+                }
+
+                return false;
+            }
 
-        auto& upvalues = closure->upvalues;
-        auto& open_upvalues = closure->open_upvalues;
+            if (const auto maybe_bound_method = try_as<GC_ptr<Bound_method>>(maybe_callable)) {
+                const auto bound_method = *maybe_bound_method;
 
-        const auto bytecode_begin = bytecode.cbegin();
-        const auto bytecode_end = bytecode.cend();
+                // Replace function at call frame stack slot 0 with "this" instance.
+                *(stack_.end() - arg_count - 1) = bound_method->instance;
 
-        auto bytecode_iter = bytecode_begin;
+                call_closure(bound_method->method, arg_count);
+                return true;
+            }
+
+            if (const auto maybe_native_fn = try_as<GC_ptr<Native_fn>>(maybe_callable)) {
+                const auto native_fn = *maybe_native_fn;
+                const auto return_value = native_fn->fn({stack_.end() - arg_count, stack_.end()});
+                stack_.erase(stack_.end() - arg_count - 1, stack_.end());
+                stack_.push_back(return_value);
+
+                return false;
+            }
+
+            std::ostringstream os;
+            os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme << "\": "
+               << "Can only call functions and classes.";
+            throw std::runtime_error{os.str()};
+        };
+
+        // Shared by add and add_local_constant. The new string isn't reachable from the roots until the caller stores it.
+        const auto concatenate = [&](GC_ptr<const String> lhs, GC_ptr<const String> rhs) -> GC_ptr<const String> {
+            return lhs->length() + rhs->length() < min_rope_length ? interned_strings_.get(lhs->chars() + rhs->chars())
+                                                                   : gc_heap_.make<const String>({gc_heap_, lhs, rhs});
+        };
+
+#ifdef MOTTS_LOX_THREADED_DISPATCH
+        // Indexed by opcode value, so this must list labels in the same order as the Opcode enum.
+        static const void* const opcode_labels[] = {
+#define X(name) &&opcode_##name,
+            MOTTS_LOX_OPCODE_NAMES
+#undef X
+        };
+#endif
+
+        load_call_frame();
+
+        while (true) {
+            // Falling off the end of a chunk is an implicit return that leaves the stack as is.
+            // Compiled functions always end with a return opcode, so in practice this is the top-level script finishing.
+            if (bytecode_iter == bytecode->cend()) {
+                call_frames_.pop_back();
+                if (call_frames_.size() == call_frames_begin_size) {
+                    return;
+                }
+                load_call_frame();
 
-        while (bytecode_iter != bytecode_end) {
-            const auto bytecode_index = bytecode_iter - bytecode_begin;
-            const auto& source_map_token = source_map_tokens[bytecode_index];
+                if (debug_) {
+                    dump_stack();
+                }
+                continue;
+            }
 
-            const auto opcode = static_cast<Opcode>(*bytecode_iter++);
+            opcode_iter = bytecode_iter;
+            opcode = static_cast<Opcode>(*bytecode_iter++);
             switch (opcode) {
                 default: {
                     std::ostringstream os;
-                    os << "[Line " << source_map_token.line << "] Error: Unexpected opcode " << opcode << ", generated from source \""
-                       << *source_map_token.lexeme << "\".";
+                    os << "[Line " << source_map_token().line << "] Error: Unexpected opcode " << opcode << ", generated from source \""
+                       << *source_map_token().lexeme << "\".";
                     throw std::runtime_error{os.str()};
                 }
 
-                case Opcode::add: {
+                MOTTS_LOX_OPCODE_CASE(add) {
                     const auto rhs = *(stack_.cend() - 1);
                     const auto lhs = *(stack_.cend() - 2);
 
-                    if (const auto maybe_double_lhs = std::get_if<double>(&lhs), maybe_double_rhs = std::get_if<double>(&rhs);
+                    if (const auto maybe_double_lhs = try_as<double>(lhs), maybe_double_rhs = try_as<double>(rhs);
                         maybe_double_lhs && maybe_double_rhs)
                     {
                         const auto result = *maybe_double_lhs + *maybe_double_rhs;
                         stack_.erase(stack_.cend() - 2, stack_.cend());
                         stack_.push_back(result);
-                    } else if (const auto maybe_string_lhs = std::get_if<GC_ptr<const std::string>>(&lhs),
-                               maybe_string_rhs = std::get_if<GC_ptr<const std::string>>(&rhs);
+                    } else if (const auto maybe_string_lhs = try_as<GC_ptr<const String>>(lhs),
+                               maybe_string_rhs = try_as<GC_ptr<const String>>(rhs);
                                maybe_string_lhs && maybe_string_rhs)
                     {
-                        auto result = **maybe_string_lhs + **maybe_string_rhs;
+                        const auto result = concatenate(*maybe_string_lhs, *maybe_string_rhs);
                         stack_.erase(stack_.cend() - 2, stack_.cend());
-                        stack_.push_back(interned_strings_.get(std::move(result)));
+                        stack_.push_back(result);
+                        collect_garbage_if_needed(source_map_token());
                     } else {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be two numbers or two strings.";
                         throw std::runtime_error{os.str()};
                     }
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::call: {
-                    const auto arg_count = *bytecode_iter++;
-                    const auto maybe_callable = *(stack_.end() - arg_count - 1);
-
-                    if (const auto maybe_closure = std::get_if<GC_ptr<Closure>>(&maybe_callable)) {
-                        const auto closure = *maybe_closure;
+                MOTTS_LOX_OPCODE_CASE(add_local_constant) {
+                    const auto local_stack_index = read_operand();
+                    const auto constant_index = read_operand();
+                    auto& local = stack_[stack_begin_index + local_stack_index];
+                    const auto& constant = (*constants)[constant_index];
 
-                        if (closure->function->arity != arg_count) {
-                            std::ostringstream os;
-                            os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme << "\": "
-                               << "Expected " << closure->function->arity << " arguments but got " << static_cast<int>(arg_count) << '.';
-                            throw std::runtime_error{os.str()};
-                        }
-
-                        run(closure, stack_.size() - arg_count - 1);
-                    } else if (const auto maybe_class = std::get_if<GC_ptr<Class>>(&maybe_callable)) {
-                        const auto klass = *maybe_class;
-                        const auto maybe_init_iter = klass->methods.find(interned_strings_.get("init"));
-                        const auto arity = maybe_init_iter != klass->methods.cend() ? maybe_init_iter->second->function->arity : 0;
-
-                        if (arity != arg_count) {
-                            std::ostringstream os;
-                            os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme << "\": "
-                               << "Expected " << arity << " arguments but got " << static_cast<int>(arg_count) << '.';
-                            throw std::runtime_error{os.str()};
-                        }
-
-                        // If there's no init method, then we'd pop the class and push the instance,
-                        // so assigning the instance into the class slot has the same effect.
-                        // But if there's an init method, then we need to prepare the stack like a bound method,
-                        // which means putting the "this" instance in the class slot before the arguments.
-                        // Either way, the instance ends up in the same slot where the class was.
-                        *(stack_.end() - arg_count - 1) = gc_heap_.make<Instance>({klass});
-
-                        if (maybe_init_iter != klass->methods.cend()) {
-                            run(maybe_init_iter->second, stack_.size() - arg_count - 1);
-                        }
-                    } else if (const auto maybe_bound_method = std::get_if<GC_ptr<Bound_method>>(&maybe_callable)) {
-                        const auto bound_method = *maybe_bound_method;
-
-                        if (bound_method->method->function->arity != arg_count) {
-                            std::ostringstream os;
-                            os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme << "\": "
-                               << "Expected " << bound_method->method->function->arity << " arguments but got "
-                               << static_cast<int>(arg_count) << '.';
-                            throw std::runtime_error{os.str()};
-                        }
-
-                        // Replace function at call frame stack slot 0 with "this" instance.
-                        *(stack_.end() - arg_count - 1) = bound_method->instance;
-
-                        run(bound_method->method, stack_.size() - arg_count - 1);
-                    } else if (const auto maybe_native_fn = std::get_if<GC_ptr<Native_fn>>(&maybe_callable)) {
-                        const auto native_fn = *maybe_native_fn;
-                        const auto return_value = native_fn->fn({stack_.end() - arg_count, stack_.end()});
-                        stack_.erase(stack_.end() - arg_count - 1, stack_.end());
-                        stack_.push_back(return_value);
+                    if (const auto maybe_double_lhs = try_as<double>(local), maybe_double_rhs = try_as<double>(constant);
+                        maybe_double_lhs && maybe_double_rhs)
+                    {
+                        local = *maybe_double_lhs + *maybe_double_rhs;
+                    } else if (const auto maybe_string_lhs = try_as<GC_ptr<const String>>(local),
+                               maybe_string_rhs = try_as<GC_ptr<const String>>(constant);
+                               maybe_string_lhs && maybe_string_rhs)
+                    {
+                        local = concatenate(*maybe_string_lhs, *maybe_string_rhs);
+                        collect_garbage_if_needed(source_map_token());
                     } else {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme << "\": "
-                           << "Can only call functions and classes.";
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
+                           << "\": Operands must be two numbers or two strings.";
                         throw std::runtime_error{os.str()};
                     }
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(call) {
+                    const auto arg_count = read_operand();
+                    if (call_value(*(stack_.end() - arg_count - 1), arg_count)) {
+                        MOTTS_LOX_DISPATCH();
+                    }
+
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::class_: {
-                    const auto class_name_constant_index = *bytecode_iter++;
-                    const auto class_name = std::get<GC_ptr<const std::string>>(constants[class_name_constant_index]);
-                    stack_.push_back(gc_heap_.make<Class>({class_name}));
+                MOTTS_LOX_OPCODE_CASE(class_) {
+                    const auto class_name_constant_index = read_operand();
+                    const auto class_name = as<GC_ptr<const String>>((*constants)[class_name_constant_index]);
+                    stack_.push_back(gc_heap_.make<Class>({class_name, gc_heap_.make<Shape>({})}));
+                    collect_garbage_if_needed(source_map_token());
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::close_upvalue: {
+                MOTTS_LOX_OPCODE_CASE(close_upvalue) {
                     // At compile-time, we lexically know we *might* capture an upvalue, and thus emit a close instruction instead of pop.
                     // But at runtime, the closure function might be conditional and might never create an open upvalue,
                     // so we need to check that we're not trying to close an upvalue that was never opened.
-                    if (! open_upvalues.empty() && open_upvalues.back()->stack_index() == stack_.size() - 1) {
-                        open_upvalues.back()->close();
-                        open_upvalues.pop_back();
-                    }
+                    close_upvalues(stack_.size() - 1);
                     stack_.pop_back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::closure: {
-                    const auto fn_constant_index = *bytecode_iter++;
-                    const auto function = std::get<GC_ptr<Function>>(constants[fn_constant_index]);
+                MOTTS_LOX_OPCODE_CASE(closure) {
+                    const auto fn_constant_index = read_operand();
+                    const auto function = as<GC_ptr<Function>>((*constants)[fn_constant_index]);
                     auto new_closure = gc_heap_.make<Closure>({function});
                     stack_.push_back(new_closure);
 
-                    const auto n_upvalues = *bytecode_iter++;
-                    for (auto n_upvalue = 0; n_upvalue != n_upvalues; ++n_upvalue) {
-                        const auto is_direct_capture = *bytecode_iter++;
-                        const auto enclosing_index = *bytecode_iter++;
+                    const auto n_upvalues = read_operand();
+                    for (std::size_t n_upvalue = 0; n_upvalue != n_upvalues; ++n_upvalue) {
+                        const auto is_direct_capture = read_operand();
+                        const auto enclosing_index = read_operand();
 
                         if (is_direct_capture) {
                             const auto stack_index = stack_begin_index + enclosing_index;
 
                             const auto maybe_existing_upvalue_iter =
-                                std::find_if(open_upvalues.cbegin(), open_upvalues.cend(), [&](const auto& open_upvalue) {
+                                std::find_if(open_upvalues_.cbegin(), open_upvalues_.cend(), [&](const auto& open_upvalue) {
                                     return open_upvalue->stack_index() == stack_index;
                                 });
 
-                            if (maybe_existing_upvalue_iter != open_upvalues.cend()) {
+                            if (maybe_existing_upvalue_iter != open_upvalues_.cend()) {
                                 new_closure->upvalues.push_back(*maybe_existing_upvalue_iter);
                             } else {
                                 const auto new_upvalue = gc_heap_.make<Upvalue>({stack_, stack_index});
@@ -231,35 +528,36 @@ namespace motts::lox
                                 // The new closure keeps upvalue for lookups.
                                 new_closure->upvalues.push_back(new_upvalue);
 
-                                // The enclosing closure keeps upvalue for auto-closing on scope exit.
+                                // The VM keeps upvalue for auto-closing on scope exit.
                                 const auto sorted_insert_position =
-                                    std::find_if(open_upvalues.cbegin(), open_upvalues.cend(), [&](const auto& open_upvalue) {
+                                    std::find_if(open_upvalues_.cbegin(), open_upvalues_.cend(), [&](const auto& open_upvalue) {
                                         return open_upvalue->stack_index() > stack_index;
                                     });
-                                open_upvalues.insert(sorted_insert_position, new_upvalue);
+                                open_upvalues_.insert(sorted_insert_position, new_upvalue);
                             }
                         } else {
-                            new_closure->upvalues.push_back(upvalues[enclosing_index]);
+                            new_closure->upvalues.push_back((*upvalues)[enclosing_index]);
                         }
                     }
+                    collect_garbage_if_needed(source_map_token());
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::constant: {
-                    const auto constant_index = *bytecode_iter++;
-                    stack_.push_back(constants[constant_index]);
+                MOTTS_LOX_OPCODE_CASE(constant) {
+                    const auto constant_index = read_operand();
+                    stack_.push_back((*constants)[constant_index]);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::divide: {
-                    const auto maybe_double_rhs = std::get_if<double>(&*(stack_.cend() - 1));
-                    const auto maybe_double_lhs = std::get_if<double>(&*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(divide) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
 
                     if (! maybe_double_lhs || ! maybe_double_rhs) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be numbers.";
                         throw std::runtime_error{os.str()};
                     }
@@ -268,119 +566,124 @@ namespace motts::lox
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::equal: {
+                MOTTS_LOX_OPCODE_CASE(equal) {
                     const auto rhs = *(stack_.cend() - 1);
                     const auto lhs = *(stack_.cend() - 2);
 
-                    const auto result = lhs == rhs;
+                    const auto result = lhs == rhs || strings_equal(interned_strings_, lhs, rhs);
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::false_: {
+                MOTTS_LOX_OPCODE_CASE(false_) {
                     stack_.push_back(false);
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::define_global: {
-                    const auto variable_name_constant_index = *bytecode_iter++;
-                    const auto variable_name = std::get<GC_ptr<const std::string>>(constants[variable_name_constant_index]);
-                    globals_[variable_name] = stack_.back();
+                MOTTS_LOX_OPCODE_CASE(define_global) {
+                    const auto variable_name_constant_index = read_operand();
+                    globals_[(*global_slot_indexes)[variable_name_constant_index]] = stack_.back();
                     stack_.pop_back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::get_global: {
-                    const auto variable_name_constant_index = *bytecode_iter++;
-                    const auto variable_name = std::get<GC_ptr<const std::string>>(constants[variable_name_constant_index]);
-
-                    const auto global_iter = globals_.find(variable_name);
-                    if (global_iter == globals_.cend()) {
+                MOTTS_LOX_OPCODE_CASE(get_global) {
+                    const auto variable_name_constant_index = read_operand();
+                    const auto& global = globals_[(*global_slot_indexes)[variable_name_constant_index]];
+                    if (global == undefined_global) {
+                        const auto variable_name = as<GC_ptr<const String>>((*constants)[variable_name_constant_index]);
                         throw std::runtime_error{
-                            "[Line " + std::to_string(source_map_token.line) + "] Error: Undefined variable \"" + *variable_name + "\"."};
+                            "[Line " + std::to_string(source_map_token().line) + "] Error: Undefined variable \"" + variable_name->chars()
+                            + "\"."};
                     }
-                    stack_.push_back(global_iter->second);
+                    stack_.push_back(global);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::get_local: {
-                    const auto local_stack_index = *bytecode_iter++;
+                MOTTS_LOX_OPCODE_CASE(get_local) {
+                    const auto local_stack_index = read_operand();
                     stack_.push_back(stack_[stack_begin_index + local_stack_index]);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::get_property: {
-                    const auto field_name_constant_index = *bytecode_iter++;
-                    const auto field_name = std::get<GC_ptr<const std::string>>(constants[field_name_constant_index]);
+                MOTTS_LOX_OPCODE_CASE(get_property) {
+                    const auto field_name_constant_index = read_operand();
+                    const auto field_name = as<GC_ptr<const String>>((*constants)[field_name_constant_index]);
 
-                    const auto maybe_instance = std::get_if<GC_ptr<Instance>>(&stack_.back());
+                    const auto maybe_instance = try_as<GC_ptr<Instance>>(stack_.back());
                     if (! maybe_instance) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Only instances have fields.";
                         throw std::runtime_error{os.str()};
                     }
                     const auto instance = *maybe_instance;
-                    stack_.pop_back();
 
-                    const auto maybe_field_iter = instance->fields.find(field_name);
-                    if (maybe_field_iter != instance->fields.cend()) {
-                        stack_.push_back(maybe_field_iter->second);
-                        break;
+                    auto& cache = inline_cache();
+                    if (instance->shape == cache.shape) {
+                        ++inline_cache_stats_.get_property.hits;
+                    } else {
+                        ++inline_cache_stats_.get_property.misses;
+                        fill_property_cache(cache, instance, field_name);
                     }
+                    stack_.pop_back();
 
-                    const auto maybe_method_iter = instance->klass->methods.find(field_name);
-                    if (maybe_method_iter != instance->klass->methods.cend()) {
-                        const auto new_bound_method = gc_heap_.make<Bound_method>({instance, maybe_method_iter->second});
-                        stack_.push_back(new_bound_method);
-                        break;
+                    // A field shadows a method of the same name.
+                    if (! cache.method) {
+                        stack_.push_back(instance->fields[cache.slot_index]);
+                        MOTTS_LOX_NEXT_OPCODE();
                     }
 
-                    throw std::runtime_error{
-                        "[Line " + std::to_string(source_map_token.line) + "] Error: Undefined property \"" + *field_name + "\"."};
+                    const auto new_bound_method = gc_heap_.make<Bound_method>({instance, cache.method});
+                    stack_.push_back(new_bound_method);
+                    collect_garbage_if_needed(source_map_token());
+
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::get_super: {
-                    const auto method_name_constant_index = *bytecode_iter++;
-                    const auto method_name = std::get<GC_ptr<const std::string>>(constants[method_name_constant_index]);
-                    const auto superclass = std::get<GC_ptr<Class>>(*(stack_.cend() - 1));
-                    const auto instance = std::get<GC_ptr<Instance>>(*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(get_super) {
+                    const auto method_name_constant_index = read_operand();
+                    const auto method_name = as<GC_ptr<const String>>((*constants)[method_name_constant_index]);
+                    const auto superclass = as<GC_ptr<Class>>(*(stack_.cend() - 1));
+                    const auto instance = as<GC_ptr<Instance>>(*(stack_.cend() - 2));
 
                     const auto maybe_method_iter = superclass->methods.find(method_name);
                     if (maybe_method_iter == superclass->methods.cend()) {
                         throw std::runtime_error{
-                            "[Line " + std::to_string(source_map_token.line) + "] Error: Undefined property \"" + *method_name + "\"."};
+                            "[Line " + std::to_string(source_map_token().line) + "] Error: Undefined property \"" + method_name->chars()
+                            + "\"."};
                     }
 
                     const auto new_bound_method = gc_heap_.make<Bound_method>({instance, maybe_method_iter->second});
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(new_bound_method);
+                    collect_garbage_if_needed(source_map_token());
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::get_upvalue: {
-                    const auto upvalue_index = *bytecode_iter++;
-                    stack_.push_back(upvalues.at(upvalue_index)->value());
+                MOTTS_LOX_OPCODE_CASE(get_upvalue) {
+                    const auto upvalue_index = read_operand();
+                    stack_.push_back(upvalues->at(upvalue_index)->value());
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::greater: {
-                    const auto maybe_double_rhs = std::get_if<double>(&*(stack_.cend() - 1));
-                    const auto maybe_double_lhs = std::get_if<double>(&*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(greater) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
 
                     if (! maybe_double_lhs || ! maybe_double_rhs) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be numbers.";
                         throw std::runtime_error{os.str()};
                     }
@@ -389,66 +692,122 @@ namespace motts::lox
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(greater_equal) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
+
+                    if (! maybe_double_lhs || ! maybe_double_rhs) {
+                        std::ostringstream os;
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
+                           << "\": Operands must be numbers.";
+                        throw std::runtime_error{os.str()};
+                    }
+
+                    // Not less, rather than greater or equal, to match the less and not opcodes this replaced, even for NaN.
+                    const auto result = ! (*maybe_double_lhs < *maybe_double_rhs);
+                    stack_.erase(stack_.cend() - 2, stack_.cend());
+                    stack_.push_back(result);
+
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::inherit: {
-                    const auto maybe_parent_class = std::get_if<GC_ptr<Class>>(&*(stack_.end() - 1));
+                MOTTS_LOX_OPCODE_CASE(inherit) {
+                    const auto maybe_parent_class = try_as<GC_ptr<Class>>(*(stack_.end() - 1));
                     if (! maybe_parent_class) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Superclass must be a class.";
                         throw std::runtime_error{os.str()};
                     }
                     const auto parent = *maybe_parent_class;
 
-                    auto child = std::get<GC_ptr<Class>>(*(stack_.end() - 2));
+                    auto child = as<GC_ptr<Class>>(*(stack_.end() - 2));
+                    write_barrier(gc_heap_, child);
                     child->methods.insert(parent->methods.cbegin(), parent->methods.cend());
 
                     // The stack has parent above the child for inheritance, but now we push child
                     // back on top again so that the subsequent method opcodes will operate on child.
                     stack_.push_back(child);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::jump:
-                case Opcode::jump_if_false:
-                case Opcode::loop: {
-                    // The jump distance spans two bytes, beginning at the current iterator position.
-                    const auto jump_distance_big_endian = reinterpret_cast<const std::uint16_t&>(*bytecode_iter);
-                    bytecode_iter += 2;
-                    const auto jump_distance = boost::endian::big_to_native(jump_distance_big_endian);
+                // A fused get_property and call. Methods are called directly, without allocating a bound method.
+                MOTTS_LOX_OPCODE_CASE(invoke) {
+                    const auto method_name_constant_index = read_operand();
+                    const auto arg_count = read_operand();
+                    const auto method_name = as<GC_ptr<const String>>((*constants)[method_name_constant_index]);
+
+                    const auto maybe_instance = try_as<GC_ptr<Instance>>(*(stack_.cend() - arg_count - 1));
+                    if (! maybe_instance) {
+                        std::ostringstream os;
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
+                           << "\": Only instances have fields.";
+                        throw std::runtime_error{os.str()};
+                    }
+                    const auto instance = *maybe_instance;
 
-                    switch (opcode) {
-                        default:
-                            throw std::logic_error{"Unreachable, probably."};
+                    auto& cache = inline_cache();
+                    if (instance->shape == cache.shape) {
+                        ++inline_cache_stats_.invoke.hits;
+                    } else {
+                        ++inline_cache_stats_.invoke.misses;
+                        fill_property_cache(cache, instance, method_name);
+                    }
 
-                        case Opcode::jump:
-                            bytecode_iter += jump_distance;
-                            break;
+                    // A field shadows a method of the same name, and it could hold any kind of callable.
+                    if (! cache.method) {
+                        const auto field = instance->fields[cache.slot_index];
+                        *(stack_.end() - arg_count - 1) = field;
+                        if (call_value(field, arg_count)) {
+                            MOTTS_LOX_DISPATCH();
+                        }
 
-                        case Opcode::jump_if_false:
-                            if (! std::visit(Is_truthy_visitor{}, stack_.back())) {
-                                bytecode_iter += jump_distance;
-                            }
-                            break;
+                        MOTTS_LOX_NEXT_OPCODE();
+                    }
+
+                    // The instance is already in the callee slot, right where the method expects "this".
+                    call_closure(cache.method, arg_count);
+                    MOTTS_LOX_DISPATCH();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(jump) {
+                    const auto jump_distance = read_jump_distance();
+                    bytecode_iter += jump_distance;
+
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
 
-                        case Opcode::loop:
-                            bytecode_iter -= jump_distance;
-                            break;
+                MOTTS_LOX_OPCODE_CASE(jump_if_false) {
+                    const auto jump_distance = read_jump_distance();
+                    if (! visit_value(Is_truthy_visitor{}, stack_.back())) {
+                        bytecode_iter += jump_distance;
                     }
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::less: {
-                    const auto maybe_double_rhs = std::get_if<double>(&*(stack_.cend() - 1));
-                    const auto maybe_double_lhs = std::get_if<double>(&*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(jump_if_false_pop) {
+                    const auto jump_distance = read_jump_distance();
+                    const auto condition = visit_value(Is_truthy_visitor{}, stack_.back());
+                    stack_.pop_back();
+                    if (! condition) {
+                        bytecode_iter += jump_distance;
+                    }
+
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(less) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
 
                     if (! maybe_double_lhs || ! maybe_double_rhs) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be numbers.";
                         throw std::runtime_error{os.str()};
                     }
@@ -457,28 +816,55 @@ namespace motts::lox
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(less_equal) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
+
+                    if (! maybe_double_lhs || ! maybe_double_rhs) {
+                        std::ostringstream os;
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
+                           << "\": Operands must be numbers.";
+                        throw std::runtime_error{os.str()};
+                    }
+
+                    // Not greater, to match the greater and not opcodes this replaced, even for NaN.
+                    const auto result = ! (*maybe_double_lhs > *maybe_double_rhs);
+                    stack_.erase(stack_.cend() - 2, stack_.cend());
+                    stack_.push_back(result);
+
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(loop) {
+                    const auto jump_distance = read_jump_distance();
+                    bytecode_iter -= jump_distance;
+
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::method: {
-                    const auto method_name_constant_index = *bytecode_iter++;
-                    const auto method_name = std::get<GC_ptr<const std::string>>(constants[method_name_constant_index]);
-                    const auto closure = std::get<GC_ptr<Closure>>(*(stack_.cend() - 1));
-                    auto klass = std::get<GC_ptr<Class>>(*(stack_.end() - 2));
+                MOTTS_LOX_OPCODE_CASE(method) {
+                    const auto method_name_constant_index = read_operand();
+                    const auto method_name = as<GC_ptr<const String>>((*constants)[method_name_constant_index]);
+                    const auto closure = as<GC_ptr<Closure>>(*(stack_.cend() - 1));
+                    auto klass = as<GC_ptr<Class>>(*(stack_.end() - 2));
 
+                    write_barrier(gc_heap_, klass);
                     klass->methods[method_name] = closure;
                     stack_.pop_back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::multiply: {
-                    const auto maybe_double_rhs = std::get_if<double>(&*(stack_.cend() - 1));
-                    const auto maybe_double_lhs = std::get_if<double>(&*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(multiply) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
 
                     if (! maybe_double_lhs || ! maybe_double_rhs) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be numbers.";
                         throw std::runtime_error{os.str()};
                     }
@@ -487,15 +873,15 @@ namespace motts::lox
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::negate: {
-                    const auto maybe_double_value = std::get_if<double>(&stack_.back());
+                MOTTS_LOX_OPCODE_CASE(negate) {
+                    const auto maybe_double_value = try_as<double>(stack_.back());
 
                     if (! maybe_double_value) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operand must be a number.";
                         throw std::runtime_error{os.str()};
                     }
@@ -504,97 +890,136 @@ namespace motts::lox
                     stack_.pop_back();
                     stack_.push_back(negated_value);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::nil: {
+                MOTTS_LOX_OPCODE_CASE(nil) {
                     stack_.push_back(nullptr);
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::not_: {
-                    const auto negated_value = ! std::visit(Is_truthy_visitor{}, stack_.back());
+                MOTTS_LOX_OPCODE_CASE(not_) {
+                    const auto negated_value = ! visit_value(Is_truthy_visitor{}, stack_.back());
                     stack_.pop_back();
                     stack_.push_back(negated_value);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
+
+                MOTTS_LOX_OPCODE_CASE(not_equal) {
+                    const auto rhs = *(stack_.cend() - 1);
+                    const auto lhs = *(stack_.cend() - 2);
+
+                    const auto result = ! (lhs == rhs || strings_equal(interned_strings_, lhs, rhs));
+                    stack_.erase(stack_.cend() - 2, stack_.cend());
+                    stack_.push_back(result);
+
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::pop: {
+                MOTTS_LOX_OPCODE_CASE(pop) {
                     stack_.pop_back();
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::print: {
+                MOTTS_LOX_OPCODE_CASE(print) {
                     os_ << stack_.back() << '\n';
                     stack_.pop_back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::return_: {
-                    for (auto& upvalue : open_upvalues) {
-                        upvalue->close();
-                    }
+                MOTTS_LOX_OPCODE_CASE(return_) {
+                    close_upvalues(stack_begin_index);
                     stack_.erase(stack_.cbegin() + stack_begin_index, stack_.cend() - 1);
 
-                    return;
-                }
+                    call_frames_.pop_back();
+                    if (call_frames_.size() == call_frames_begin_size) {
+                        return;
+                    }
+                    load_call_frame();
 
-                case Opcode::set_global: {
-                    const auto variable_name_constant_index = *bytecode_iter++;
-                    const auto variable_name = std::get<GC_ptr<const std::string>>(constants[variable_name_constant_index]);
+                    MOTTS_LOX_NEXT_OPCODE();
+                }
 
-                    const auto global_iter = globals_.find(variable_name);
-                    if (global_iter == globals_.cend()) {
+                MOTTS_LOX_OPCODE_CASE(set_global) {
+                    const auto variable_name_constant_index = read_operand();
+                    auto& global = globals_[(*global_slot_indexes)[variable_name_constant_index]];
+                    if (global == undefined_global) {
+                        const auto variable_name = as<GC_ptr<const String>>((*constants)[variable_name_constant_index]);
                         throw std::runtime_error{
-                            "[Line " + std::to_string(source_map_token.line) + "] Error: Undefined variable \"" + *variable_name + "\"."};
+                            "[Line " + std::to_string(source_map_token().line) + "] Error: Undefined variable \"" + variable_name->chars()
+                            + "\"."};
                     }
-                    global_iter->second = stack_.back();
+                    global = stack_.back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::set_local: {
-                    const auto local_stack_index = *bytecode_iter++;
+                MOTTS_LOX_OPCODE_CASE(set_local) {
+                    const auto local_stack_index = read_operand();
                     stack_.at(stack_begin_index + local_stack_index) = stack_.back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::set_property: {
-                    const auto field_name_constant_index = *bytecode_iter++;
-                    const auto field_name = std::get<GC_ptr<const std::string>>(constants[field_name_constant_index]);
+                MOTTS_LOX_OPCODE_CASE(set_property) {
+                    const auto field_name_constant_index = read_operand();
+                    const auto field_name = as<GC_ptr<const String>>((*constants)[field_name_constant_index]);
 
-                    const auto maybe_instance = std::get_if<GC_ptr<Instance>>(&*(stack_.cend() - 1));
+                    const auto maybe_instance = try_as<GC_ptr<Instance>>(*(stack_.cend() - 1));
                     if (! maybe_instance) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Only instances have fields.";
                         throw std::runtime_error{os.str()};
                     }
                     auto instance = *maybe_instance;
+                    const auto value = *(stack_.cend() - 2);
+                    write_barrier(gc_heap_, instance);
+
+                    auto& cache = inline_cache();
+                    if (instance->shape == cache.shape) {
+                        ++inline_cache_stats_.set_property.hits;
+
+                        // Same shape means the same number of fields, so a new field always lands at the end.
+                        if (cache.next_shape) {
+                            instance->shape = cache.next_shape;
+                            instance->fields.push_back(value);
+                        } else {
+                            instance->fields[cache.slot_index] = value;
+                        }
+                    } else {
+                        ++inline_cache_stats_.set_property.misses;
 
-                    instance->fields[field_name] = *(stack_.cend() - 2);
+                        const auto shape_before = instance->shape;
+                        write_barrier(gc_heap_, call_frames_.back().closure->function);
+                        instance->set_field(gc_heap_, field_name, value);
+                        const auto slot_index = instance->shape->slot_indexes.at(field_name);
+                        cache = {shape_before, slot_index, instance->shape == shape_before ? GC_ptr<Shape>{} : instance->shape, {}};
+                    }
                     stack_.pop_back();
+                    collect_garbage_if_needed(source_map_token());
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::set_upvalue: {
-                    const auto upvalue_index = *bytecode_iter++;
-                    upvalues.at(upvalue_index)->value() = stack_.back();
+                MOTTS_LOX_OPCODE_CASE(set_upvalue) {
+                    const auto upvalue_index = read_operand();
+                    auto upvalue = upvalues->at(upvalue_index);
+                    write_barrier(gc_heap_, upvalue);
+                    upvalue->value() = stack_.back();
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::subtract: {
-                    const auto maybe_double_rhs = std::get_if<double>(&*(stack_.cend() - 1));
-                    const auto maybe_double_lhs = std::get_if<double>(&*(stack_.cend() - 2));
+                MOTTS_LOX_OPCODE_CASE(subtract) {
+                    const auto maybe_double_rhs = try_as<double>(*(stack_.cend() - 1));
+                    const auto maybe_double_lhs = try_as<double>(*(stack_.cend() - 2));
 
                     if (! maybe_double_lhs || ! maybe_double_rhs) {
                         std::ostringstream os;
-                        os << "[Line " << source_map_token.line << "] Error at \"" << *source_map_token.lexeme
+                        os << "[Line " << source_map_token().line << "] Error at \"" << *source_map_token().lexeme
                            << "\": Operands must be numbers.";
                         throw std::runtime_error{os.str()};
                     }
@@ -603,38 +1028,44 @@ namespace motts::lox
                     stack_.erase(stack_.cend() - 2, stack_.cend());
                     stack_.push_back(result);
 
-                    break;
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
 
-                case Opcode::true_: {
-                    stack_.push_back(true);
-                    break;
-                }
-            }
+                // A fused get_super and call. The superclass is on top of the arguments, and the instance is below them.
+                MOTTS_LOX_OPCODE_CASE(super_invoke) {
+                    const auto method_name_constant_index = read_operand();
+                    const auto arg_count = read_operand();
+                    const auto method_name = as<GC_ptr<const String>>((*constants)[method_name_constant_index]);
+                    const auto superclass = as<GC_ptr<Class>>(stack_.back());
 
-            // Run the garbage collector only occassionally based on how fast the allocation size grows.
-            // 4K is (semi) arbitrarily chosen. Could be tuned with performance testing.
-            if (gc_heap_.size() - gc_heap_last_collect_size_ > 4096) {
-                if (debug_) {
-                    os_ << "# Collecting garbage: " << gc_heap_.size() << " bytes -> ";
-                }
+                    const auto maybe_method_iter = superclass->methods.find(method_name);
+                    if (maybe_method_iter == superclass->methods.cend()) {
+                        throw std::runtime_error{
+                            "[Line " + std::to_string(source_map_token().line) + "] Error: Undefined property \"" + method_name->chars()
+                            + "\"."};
+                    }
+                    stack_.pop_back();
 
-                gc_heap_.collect_garbage();
-                gc_heap_last_collect_size_ = gc_heap_.size();
+                    call_closure(maybe_method_iter->second, arg_count);
+                    MOTTS_LOX_DISPATCH();
+                }
 
-                if (debug_) {
-                    os_ << gc_heap_last_collect_size_ << '\n';
+                MOTTS_LOX_OPCODE_CASE(true_) {
+                    stack_.push_back(true);
+                    MOTTS_LOX_NEXT_OPCODE();
                 }
-            }
 
-            if (debug_) {
-                os_ << "# Stack:\n";
-                for (auto stack_iter = stack_.crbegin(); stack_iter != stack_.crend(); ++stack_iter) {
-                    const auto stack_index = stack_iter.base() - 1 - stack_.cbegin();
-                    os_ << std::setw(5) << std::setfill(' ') << std::right << stack_index << " : " << *stack_iter << '\n';
+                // A prefix rather than an instruction of its own, so go straight on to the opcode it applies to.
+                MOTTS_LOX_OPCODE_CASE(wide) {
+                    wide = true;
+                    MOTTS_LOX_FETCH();
                 }
-                os_ << '\n';
             }
         }
     }
+
+#undef MOTTS_LOX_NEXT_OPCODE
+#undef MOTTS_LOX_DISPATCH
+#undef MOTTS_LOX_FETCH
+#undef MOTTS_LOX_OPCODE_CASE
 }
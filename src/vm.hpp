@@ -1,7 +1,7 @@
 #pragma once
 
+#include <cstdint>
 #include <ostream>
-#include <unordered_map>
 #include <vector>
 
 #include "chunk.hpp"
@@ -11,25 +11,78 @@
 
 namespace motts::lox
 {
+    // How often each kind of property opcode found its inline cache already filled for the receiver's shape.
+    struct Inline_cache_stats
+    {
+        struct Counts
+        {
+            std::size_t hits{0};
+            std::size_t misses{0};
+        };
+
+        Counts get_property;
+        Counts set_property;
+        Counts invoke;
+    };
+
+    std::ostream& operator<<(std::ostream&, const Inline_cache_stats&);
+
     class VM
     {
+        // Each Lox call pushes one of these rather than recursing on the native stack,
+        // so the depth of Lox recursion is bounded by `max_call_frames_` instead of by the OS.
+        struct Call_frame
+        {
+            GC_ptr<Closure> closure;
+
+            // Where to resume in the closure's bytecode after a callee returns.
+            std::vector<std::uint8_t>::const_iterator bytecode_iter;
+
+            // Stack slot 0 of this frame, which holds the callee itself or the "this" instance.
+            std::size_t stack_begin_index;
+        };
+
         const bool debug_;
+        const std::size_t max_call_frames_;
         std::ostream& os_;
         GC_heap& gc_heap_;
         Interned_strings& interned_strings_;
-        std::size_t gc_heap_last_collect_size_{0};
+
+        // For debug output about the collection in progress.
+        std::size_t gc_heap_size_before_collect_{0};
+        bool gc_collect_is_full_{false};
 
         std::vector<Dynamic_type_value> stack_;
-        std::vector<GC_ptr<Closure>> call_frames_;
-        std::unordered_map<GC_ptr<const std::string>, Dynamic_type_value> globals_;
+        std::vector<Call_frame> call_frames_;
+
+        // Indexed by the global slots that Interned_strings hands out to the compiler.
+        // A slot that was never defined holds a sentinel, since a later script may still define it.
+        std::vector<Dynamic_type_value> globals_;
+
+        // Following Lua, we’ll use "open upvalue" to refer to an upvalue that points to a local variable still on the stack.
+        // Kept sorted by stack index so that closing a scope or a call frame only ever touches the tail.
+        std::vector<GC_ptr<Upvalue>> open_upvalues_;
+
+        Inline_cache_stats inline_cache_stats_;
 
       public:
-        VM(GC_heap&, Interned_strings&, std::ostream&, bool debug = false);
+        static constexpr std::size_t default_max_call_frames{65'536};
+
+        VM(GC_heap&, Interned_strings&, std::ostream&, bool debug = false, std::size_t max_call_frames = default_max_call_frames);
         ~VM();
 
         void run(GC_ptr<Function>);
 
+        const Inline_cache_stats& inline_cache_stats() const;
+
       private:
-        void run(GC_ptr<Closure>, std::size_t stack_begin_index);
+        // Close every open upvalue that points at or above the given stack index.
+        void close_upvalues(std::size_t stack_begin_index);
+
+        // Handlers that allocate call this afterward. Nothing else can grow the heap, so nothing else needs to check.
+        // If the heap is still over its limit after an emergency collection, this throws a runtime error at the given token.
+        void collect_garbage_if_needed(const Source_map_token&);
+
+        void dump_stack() const;
     };
 }
@@ -59,6 +59,84 @@ BOOST_AUTO_TEST_CASE(debug_option_will_print_bytecode_and_stack)
     BOOST_TEST(exit_code == 0);
 }
 
+BOOST_AUTO_TEST_CASE(ic_stats_option_will_print_inline_cache_counts)
+{
+    boost::process::ipstream cpplox_out;
+    boost::process::ipstream cpplox_err;
+    const auto exit_code = boost::process::system(
+        "cpploxbc ../src/test/lox/hello.lox --ic-stats",
+        boost::process::std_out > cpplox_out,
+        boost::process::std_err > cpplox_err
+    );
+    std::string actual_out{std::istreambuf_iterator<char>{cpplox_out}, {}};
+    std::string actual_err{std::istreambuf_iterator<char>{cpplox_err}, {}};
+
+    // clang-format off
+    const auto expected_err =
+        "# Inline caches:\n"
+        "    GET_PROPERTY : 0 hits, 0 misses\n"
+        "    SET_PROPERTY : 0 hits, 0 misses\n"
+        "    INVOKE       : 0 hits, 0 misses\n";
+    // clang-format on
+
+    BOOST_TEST(actual_out == "Hello, World!\n");
+    BOOST_TEST(actual_err == expected_err);
+    BOOST_TEST(exit_code == 0);
+}
+
+BOOST_AUTO_TEST_CASE(gc_stats_option_will_print_json)
+{
+    boost::process::ipstream cpplox_out;
+    boost::process::ipstream cpplox_err;
+    const auto exit_code = boost::process::system(
+        "cpploxbc ../src/test/lox/hello.lox --gc-stats",
+        boost::process::std_out > cpplox_out,
+        boost::process::std_err > cpplox_err
+    );
+    std::string actual_out{std::istreambuf_iterator<char>{cpplox_out}, {}};
+    std::string actual_err{std::istreambuf_iterator<char>{cpplox_err}, {}};
+
+    BOOST_TEST(actual_out == "Hello, World!\n");
+    BOOST_TEST(actual_err.starts_with("{\n    \"n_young_collections\": 0,\n"));
+    BOOST_TEST(actual_err.find("\"live_objects_by_type\": [") != std::string::npos);
+    BOOST_TEST(actual_err.ends_with("}\n"));
+    BOOST_TEST(exit_code == 0);
+}
+
+BOOST_AUTO_TEST_CASE(gc_options_will_tune_collection_thresholds)
+{
+    boost::process::ipstream cpplox_out;
+    boost::process::ipstream cpplox_err;
+    const auto exit_code = boost::process::system(
+        "cpploxbc ../src/test/lox/hello.lox --gc-growth-factor 1.5 --gc-min-heap 0",
+        boost::process::std_out > cpplox_out,
+        boost::process::std_err > cpplox_err
+    );
+    std::string actual_out{std::istreambuf_iterator<char>{cpplox_out}, {}};
+    std::string actual_err{std::istreambuf_iterator<char>{cpplox_err}, {}};
+
+    BOOST_TEST(actual_out == "Hello, World!\n");
+    BOOST_TEST(actual_err == "");
+    BOOST_TEST(exit_code == 0);
+}
+
+BOOST_AUTO_TEST_CASE(gc_growth_factor_less_than_one_will_print_to_stderr_and_set_exit_code)
+{
+    boost::process::ipstream cpplox_out;
+    boost::process::ipstream cpplox_err;
+    const auto exit_code = boost::process::system(
+        "cpploxbc ../src/test/lox/hello.lox --gc-growth-factor 0.5",
+        boost::process::std_out > cpplox_out,
+        boost::process::std_err > cpplox_err
+    );
+    std::string actual_out{std::istreambuf_iterator<char>{cpplox_out}, {}};
+    std::string actual_err{std::istreambuf_iterator<char>{cpplox_err}, {}};
+
+    BOOST_TEST(actual_out == "");
+    BOOST_TEST(actual_err == "GC growth factor must be at least 1.\n");
+    BOOST_TEST(exit_code == 1);
+}
+
 BOOST_AUTO_TEST_CASE(invalid_syntax_will_print_to_stderr_and_set_exit_code)
 {
     boost::process::ipstream cpplox_out;
@@ -2,6 +2,8 @@
 
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -55,6 +57,106 @@ BOOST_AUTO_TEST_CASE(chunks_can_be_printed)
     BOOST_TEST(os.str() == expected);
 }
 
+BOOST_AUTO_TEST_CASE(inline_caches_will_be_one_per_property_opcode)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    const auto fn = compile(gc_heap, interned_strings, "var o; o.a = o.b; o.c(); print o.a;");
+    const auto& chunk = fn->chunk;
+
+    // Each property opcode finds its own cache, in order.
+    BOOST_TEST(chunk.inline_caches().size() == 4);
+
+    std::vector<std::uint32_t> property_opcode_cache_indexes;
+    for (std::size_t index = 0; index != chunk.bytecode().size(); ++index) {
+        const auto opcode = static_cast<motts::lox::Opcode>(chunk.bytecode()[index]);
+        if (opcode == motts::lox::Opcode::get_property || opcode == motts::lox::Opcode::set_property
+            || opcode == motts::lox::Opcode::invoke)
+        {
+            property_opcode_cache_indexes.push_back(chunk.inline_cache_indexes().at(index));
+        }
+    }
+    BOOST_TEST(property_opcode_cache_indexes == (std::vector<std::uint32_t>{0, 1, 2, 3}), boost::test_tools::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(constants_will_be_deduplicated_by_identity)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    const motts::lox::Source_map_token token{interned_strings.get("42"), 1};
+
+    motts::lox::Chunk chunk;
+    for (auto i = 0; i != 1'000; ++i) {
+        chunk.emit_constant(static_cast<double>(i % 100), token);
+        chunk.emit_constant(interned_strings.get(std::to_string(i % 100)), token);
+    }
+    chunk.emit_constant(-0.0, token);
+    chunk.end_compile();
+    chunk.emit_constant(99.0, token);
+
+    BOOST_TEST(chunk.constants().size() == 201);
+    BOOST_TEST(chunk.bytecode().at(chunk.bytecode().size() - 3) == 200);
+    BOOST_TEST(chunk.bytecode().back() == 198);
+}
+
+BOOST_AUTO_TEST_CASE(operands_too_big_for_a_byte_will_be_wide)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    const motts::lox::Source_map_token token{interned_strings.get("42"), 1};
+
+    motts::lox::Chunk chunk;
+    for (auto i = 0; i != 257; ++i) {
+        chunk.emit_constant(static_cast<double>(i), token);
+    }
+    chunk.emit<motts::lox::Opcode::get_local>(300, token);
+    chunk.emit<motts::lox::Opcode::set_local>(255, token);
+
+    std::ostringstream os;
+    os << chunk;
+
+    // clang-format off
+    const auto* expected =
+        "  510 : 00 ff    CONSTANT [255]          ; 42 @ 1\n"
+        "  512 : 2a       WIDE                    ; 42 @ 1\n"
+        "  513 : 00 0100    CONSTANT [256]        ; 42 @ 1\n"
+        "  516 : 2a       WIDE                    ; 42 @ 1\n"
+        "  517 : 05 012c    GET_LOCAL [300]       ; 42 @ 1\n"
+        "  520 : 06 ff    SET_LOCAL [255]         ; 42 @ 1\n"
+        "Constants:\n";
+    // clang-format on
+
+    BOOST_TEST(os.str().find(expected) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(jumps_too_far_for_16_bits_will_be_wide)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    std::string source{"var x = false; if (x) {"};
+    for (auto i = 0; i != 14'000; ++i) {
+        source += "x = " + std::to_string(i) + ";";
+    }
+    source += "}";
+
+    const auto fn = compile(gc_heap, interned_strings, source);
+    std::ostringstream os;
+    os << fn->chunk;
+
+    // clang-format off
+    const auto* expected =
+        "    3 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    5 : 2a       WIDE                    ; if @ 1\n"
+        "    6 : 28 00 01 7c d2 JUMP_IF_FALSE_POP +97490 -> 97501 ; if @ 1\n"
+        "   11 : 00 01    CONSTANT [1]            ; 0 @ 1\n";
+    // clang-format on
+
+    BOOST_TEST(os.str().find(expected) != std::string::npos);
+    BOOST_TEST(fn->chunk.bytecode().size() == 97'501);
+}
+
 BOOST_AUTO_TEST_CASE(number_literals_compile)
 {
     motts::lox::GC_heap gc_heap;
@@ -162,7 +264,7 @@ BOOST_AUTO_TEST_CASE(addition_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "28 + 14;");
+    const auto root_fn = compile(gc_heap, interned_strings, "x + y;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -171,13 +273,13 @@ BOOST_AUTO_TEST_CASE(addition_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 00 00    CONSTANT [0]            ; 28 @ 1\n"
-        "    2 : 00 01    CONSTANT [1]            ; 14 @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 07 01    GET_GLOBAL [1]          ; y @ 1\n"
         "    4 : 12       ADD                     ; + @ 1\n"
         "    5 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    0 : 28\n"
-        "    1 : 14\n";
+        "    0 : x\n"
+        "    1 : y\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -226,7 +328,7 @@ BOOST_AUTO_TEST_CASE(plus_minus_star_slash_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "1 + 2 - 3 * 5 / 7;");
+    const auto root_fn = compile(gc_heap, interned_strings, "a + b - c * d / e;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -235,22 +337,22 @@ BOOST_AUTO_TEST_CASE(plus_minus_star_slash_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
-        "    2 : 00 01    CONSTANT [1]            ; 2 @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "    2 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
         "    4 : 12       ADD                     ; + @ 1\n"
-        "    5 : 00 02    CONSTANT [2]            ; 3 @ 1\n"
-        "    7 : 00 03    CONSTANT [3]            ; 5 @ 1\n"
+        "    5 : 07 02    GET_GLOBAL [2]          ; c @ 1\n"
+        "    7 : 07 03    GET_GLOBAL [3]          ; d @ 1\n"
         "    9 : 14       MULTIPLY                ; * @ 1\n"
-        "   10 : 00 04    CONSTANT [4]            ; 7 @ 1\n"
+        "   10 : 07 04    GET_GLOBAL [4]          ; e @ 1\n"
         "   12 : 15       DIVIDE                  ; / @ 1\n"
         "   13 : 13       SUBTRACT                ; - @ 1\n"
         "   14 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    0 : 1\n"
-        "    1 : 2\n"
-        "    2 : 3\n"
-        "    3 : 5\n"
-        "    4 : 7\n";
+        "    0 : a\n"
+        "    1 : b\n"
+        "    2 : c\n"
+        "    3 : d\n"
+        "    4 : e\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -260,7 +362,7 @@ BOOST_AUTO_TEST_CASE(parens_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "1 + (2 - 3) * 5 / 7;");
+    const auto root_fn = compile(gc_heap, interned_strings, "a + (b - c) * d / e;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -269,22 +371,22 @@ BOOST_AUTO_TEST_CASE(parens_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
-        "    2 : 00 01    CONSTANT [1]            ; 2 @ 1\n"
-        "    4 : 00 02    CONSTANT [2]            ; 3 @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "    2 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "    4 : 07 02    GET_GLOBAL [2]          ; c @ 1\n"
         "    6 : 13       SUBTRACT                ; - @ 1\n"
-        "    7 : 00 03    CONSTANT [3]            ; 5 @ 1\n"
+        "    7 : 07 03    GET_GLOBAL [3]          ; d @ 1\n"
         "    9 : 14       MULTIPLY                ; * @ 1\n"
-        "   10 : 00 04    CONSTANT [4]            ; 7 @ 1\n"
+        "   10 : 07 04    GET_GLOBAL [4]          ; e @ 1\n"
         "   12 : 15       DIVIDE                  ; / @ 1\n"
         "   13 : 12       ADD                     ; + @ 1\n"
         "   14 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    0 : 1\n"
-        "    1 : 2\n"
-        "    2 : 3\n"
-        "    3 : 5\n"
-        "    4 : 7\n";
+        "    0 : a\n"
+        "    1 : b\n"
+        "    2 : c\n"
+        "    3 : d\n"
+        "    4 : e\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -294,7 +396,7 @@ BOOST_AUTO_TEST_CASE(numeric_negation_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "-1 + -1;");
+    const auto root_fn = compile(gc_heap, interned_strings, "-x + -x;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -303,14 +405,14 @@ BOOST_AUTO_TEST_CASE(numeric_negation_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
         "    2 : 17       NEGATE                  ; - @ 1\n"
-        "    3 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
+        "    3 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
         "    5 : 17       NEGATE                  ; - @ 1\n"
         "    6 : 12       ADD                     ; + @ 1\n"
         "    7 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    0 : 1\n";
+        "    0 : x\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -320,7 +422,7 @@ BOOST_AUTO_TEST_CASE(boolean_negation_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "!true;");
+    const auto root_fn = compile(gc_heap, interned_strings, "!x;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -329,11 +431,11 @@ BOOST_AUTO_TEST_CASE(boolean_negation_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 16       NOT                     ; ! @ 1\n"
-        "    2 : 04       POP                     ; ; @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 16       NOT                     ; ! @ 1\n"
+        "    3 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    -\n";
+        "    0 : x\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -365,7 +467,7 @@ BOOST_AUTO_TEST_CASE(comparisons_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "1 > 2; 3 >= 5; 7 == 11; 13 != 17; 19 <= 23; 29 < 31;");
+    const auto root_fn = compile(gc_heap, interned_strings, "a > b; a >= b; a == b; a != b; a <= b; a < b;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -374,51 +476,38 @@ BOOST_AUTO_TEST_CASE(comparisons_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
-        "    2 : 00 01    CONSTANT [1]            ; 2 @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "    2 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
         "    4 : 10       GREATER                 ; > @ 1\n"
         "    5 : 04       POP                     ; ; @ 1\n"
 
-        "    6 : 00 02    CONSTANT [2]            ; 3 @ 1\n"
-        "    8 : 00 03    CONSTANT [3]            ; 5 @ 1\n"
-        "   10 : 11       LESS                    ; >= @ 1\n"
-        "   11 : 16       NOT                     ; >= @ 1\n"
-        "   12 : 04       POP                     ; ; @ 1\n"
+        "    6 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "    8 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "   10 : 25       GREATER_EQUAL           ; >= @ 1\n"
+        "   11 : 04       POP                     ; ; @ 1\n"
 
-        "   13 : 00 04    CONSTANT [4]            ; 7 @ 1\n"
-        "   15 : 00 05    CONSTANT [5]            ; 11 @ 1\n"
-        "   17 : 0f       EQUAL                   ; == @ 1\n"
-        "   18 : 04       POP                     ; ; @ 1\n"
-
-        "   19 : 00 06    CONSTANT [6]            ; 13 @ 1\n"
-        "   21 : 00 07    CONSTANT [7]            ; 17 @ 1\n"
-        "   23 : 0f       EQUAL                   ; != @ 1\n"
-        "   24 : 16       NOT                     ; != @ 1\n"
-        "   25 : 04       POP                     ; ; @ 1\n"
-
-        "   26 : 00 08    CONSTANT [8]            ; 19 @ 1\n"
-        "   28 : 00 09    CONSTANT [9]            ; 23 @ 1\n"
-        "   30 : 10       GREATER                 ; <= @ 1\n"
-        "   31 : 16       NOT                     ; <= @ 1\n"
-        "   32 : 04       POP                     ; ; @ 1\n"
-
-        "   33 : 00 0a    CONSTANT [10]           ; 29 @ 1\n"
-        "   35 : 00 0b    CONSTANT [11]           ; 31 @ 1\n"
-        "   37 : 11       LESS                    ; < @ 1\n"
-        "   38 : 04       POP                     ; ; @ 1\n"
-        "Constants:\n"
-        "    0 : 1\n"
-        "    1 : 2\n"
-        "    2 : 3\n"
-        "    3 : 5\n"
-        "    4 : 7\n"
-        "    5 : 11\n"
-        "    6 : 13\n"
-        "    7 : 17\n"
-        "    8 : 19\n"
-        "    9 : 23\n"
-        "   10 : 29\n"
-        "   11 : 31\n";
+        "   12 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "   14 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "   16 : 0f       EQUAL                   ; == @ 1\n"
+        "   17 : 04       POP                     ; ; @ 1\n"
+
+        "   18 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "   20 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "   22 : 27       NOT_EQUAL               ; != @ 1\n"
+        "   23 : 04       POP                     ; ; @ 1\n"
+
+        "   24 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "   26 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "   28 : 26       LESS_EQUAL              ; <= @ 1\n"
+        "   29 : 04       POP                     ; ; @ 1\n"
+
+        "   30 : 07 00    GET_GLOBAL [0]          ; a @ 1\n"
+        "   32 : 07 01    GET_GLOBAL [1]          ; b @ 1\n"
+        "   34 : 11       LESS                    ; < @ 1\n"
+        "   35 : 04       POP                     ; ; @ 1\n"
+        "Constants:\n"
+        "    0 : a\n"
+        "    1 : b\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -428,7 +517,7 @@ BOOST_AUTO_TEST_CASE(boolean_and_with_short_circuit_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "true and false;");
+    const auto root_fn = compile(gc_heap, interned_strings, "x and y;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -437,13 +526,14 @@ BOOST_AUTO_TEST_CASE(boolean_and_with_short_circuit_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 1a 00 02 JUMP_IF_FALSE +2 -> 6   ; and @ 1\n"
-        "    4 : 04       POP                     ; and @ 1\n"
-        "    5 : 03       FALSE                   ; false @ 1\n"
-        "    6 : 04       POP                     ; ; @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 1a 00 03 JUMP_IF_FALSE +3 -> 8   ; and @ 1\n"
+        "    5 : 04       POP                     ; and @ 1\n"
+        "    6 : 07 01    GET_GLOBAL [1]          ; y @ 1\n"
+        "    8 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    -\n";
+        "    0 : x\n"
+        "    1 : y\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -453,7 +543,7 @@ BOOST_AUTO_TEST_CASE(boolean_or_with_short_circuit_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "true or false;");
+    const auto root_fn = compile(gc_heap, interned_strings, "x or y;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -462,14 +552,68 @@ BOOST_AUTO_TEST_CASE(boolean_or_with_short_circuit_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 1a 00 03 JUMP_IF_FALSE +3 -> 7   ; or @ 1\n"
-        "    4 : 19 00 02 JUMP +2 -> 9            ; or @ 1\n"
-        "    7 : 04       POP                     ; or @ 1\n"
-        "    8 : 03       FALSE                   ; false @ 1\n"
-        "    9 : 04       POP                     ; ; @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 1a 00 03 JUMP_IF_FALSE +3 -> 8   ; or @ 1\n"
+        "    5 : 19 00 03 JUMP +3 -> 11           ; or @ 1\n"
+        "    8 : 04       POP                     ; or @ 1\n"
+        "    9 : 07 01    GET_GLOBAL [1]          ; y @ 1\n"
+        "   11 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    -\n";
+        "    0 : x\n"
+        "    1 : y\n";
+    // clang-format on
+
+    BOOST_TEST(os.str() == expected);
+}
+
+BOOST_AUTO_TEST_CASE(constant_expressions_will_fold)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    // Only the constant prefix of `1 + 2 + x` folds, and `1 + true` is left for the VM to report.
+    const auto root_fn = compile(
+        gc_heap,
+        interned_strings,
+        "1 + 2 * 3;\n"
+        "\"a\" + \"b\";\n"
+        "!nil == (2 >= 1);\n"
+        "1 + 2 + x;\n"
+        "x * -(4 - 6);\n"
+        "1 + true;\n"
+    );
+    const auto& chunk = root_fn->chunk;
+
+    std::ostringstream os;
+    os << chunk;
+
+    // clang-format off
+    const auto* expected =
+        "Bytecode:\n"
+        "    0 : 00 00    CONSTANT [0]            ; 1 @ 1\n"
+        "    2 : 04       POP                     ; ; @ 1\n"
+        "    3 : 00 01    CONSTANT [1]            ; \"a\" @ 2\n"
+        "    5 : 04       POP                     ; ; @ 2\n"
+        "    6 : 02       TRUE                    ; ! @ 3\n"
+        "    7 : 04       POP                     ; ; @ 3\n"
+        "    8 : 00 02    CONSTANT [2]            ; 1 @ 4\n"
+        "   10 : 07 03    GET_GLOBAL [3]          ; x @ 4\n"
+        "   12 : 12       ADD                     ; + @ 4\n"
+        "   13 : 04       POP                     ; ; @ 4\n"
+        "   14 : 07 03    GET_GLOBAL [3]          ; x @ 5\n"
+        "   16 : 00 04    CONSTANT [4]            ; - @ 5\n"
+        "   18 : 14       MULTIPLY                ; * @ 5\n"
+        "   19 : 04       POP                     ; ; @ 5\n"
+        "   20 : 00 05    CONSTANT [5]            ; 1 @ 6\n"
+        "   22 : 02       TRUE                    ; true @ 6\n"
+        "   23 : 12       ADD                     ; + @ 6\n"
+        "   24 : 04       POP                     ; ; @ 6\n"
+        "Constants:\n"
+        "    0 : 7\n"
+        "    1 : ab\n"
+        "    2 : 3\n"
+        "    3 : x\n"
+        "    4 : 2\n"
+        "    5 : 1\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -543,15 +687,13 @@ BOOST_AUTO_TEST_CASE(while_loop_will_compile)
         "    5 : 07 01    GET_GLOBAL [1]          ; x @ 1\n"
         "    7 : 00 02    CONSTANT [2]            ; 0 @ 1\n"
         "    9 : 10       GREATER                 ; > @ 1\n"
-        "   10 : 1a 00 0c JUMP_IF_FALSE +12 -> 25 ; while @ 1\n"
-        "   13 : 04       POP                     ; while @ 1\n"
-        "   14 : 07 01    GET_GLOBAL [1]          ; x @ 1\n"
-        "   16 : 00 03    CONSTANT [3]            ; 1 @ 1\n"
-        "   18 : 13       SUBTRACT                ; - @ 1\n"
-        "   19 : 09 01    SET_GLOBAL [1]          ; x @ 1\n"
-        "   21 : 04       POP                     ; ; @ 1\n"
-        "   22 : 1b 00 14 LOOP -20 -> 5           ; while @ 1\n"
-        "   25 : 04       POP                     ; while @ 1\n"
+        "   10 : 28 00 0b JUMP_IF_FALSE_POP +11 -> 24 ; while @ 1\n"
+        "   13 : 07 01    GET_GLOBAL [1]          ; x @ 1\n"
+        "   15 : 00 03    CONSTANT [3]            ; 1 @ 1\n"
+        "   17 : 13       SUBTRACT                ; - @ 1\n"
+        "   18 : 09 01    SET_GLOBAL [1]          ; x @ 1\n"
+        "   20 : 04       POP                     ; ; @ 1\n"
+        "   21 : 1b 00 13 LOOP -19 -> 5           ; while @ 1\n"
         "Constants:\n"
         "    0 : 42\n"
         "    1 : x\n"
@@ -700,7 +842,7 @@ BOOST_AUTO_TEST_CASE(if_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "if (true) nil;");
+    const auto root_fn = compile(gc_heap, interned_strings, "if (x) nil;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -709,15 +851,12 @@ BOOST_AUTO_TEST_CASE(if_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 1a 00 06 JUMP_IF_FALSE +6 -> 10  ; if @ 1\n"
-        "    4 : 04       POP                     ; if @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 28 00 02 JUMP_IF_FALSE_POP +2 -> 7 ; if @ 1\n"
         "    5 : 01       NIL                     ; nil @ 1\n"
         "    6 : 04       POP                     ; ; @ 1\n"
-        "    7 : 19 00 01 JUMP +1 -> 11           ; if @ 1\n"
-        "   10 : 04       POP                     ; if @ 1\n"
         "Constants:\n"
-        "    -\n";
+        "    0 : x\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -727,7 +866,7 @@ BOOST_AUTO_TEST_CASE(if_else_will_compile)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "if (true) nil; else nil;");
+    const auto root_fn = compile(gc_heap, interned_strings, "if (x) nil; else nil;");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -736,17 +875,15 @@ BOOST_AUTO_TEST_CASE(if_else_will_compile)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 1a 00 06 JUMP_IF_FALSE +6 -> 10  ; if @ 1\n"
-        "    4 : 04       POP                     ; if @ 1\n"
+        "    0 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    2 : 28 00 05 JUMP_IF_FALSE_POP +5 -> 10 ; if @ 1\n"
         "    5 : 01       NIL                     ; nil @ 1\n"
         "    6 : 04       POP                     ; ; @ 1\n"
-        "    7 : 19 00 03 JUMP +3 -> 13           ; if @ 1\n"
-        "   10 : 04       POP                     ; if @ 1\n"
-        "   11 : 01       NIL                     ; nil @ 1\n"
-        "   12 : 04       POP                     ; ; @ 1\n"
+        "    7 : 19 00 02 JUMP +2 -> 12           ; if @ 1\n"
+        "   10 : 01       NIL                     ; nil @ 1\n"
+        "   11 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    -\n";
+        "    0 : x\n";
     // clang-format on
 
     BOOST_TEST(os.str() == expected);
@@ -756,7 +893,7 @@ BOOST_AUTO_TEST_CASE(if_block_will_create_a_scope)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
-    const auto root_fn = compile(gc_heap, interned_strings, "{ var x = 42; if (true) { var x = 14; } x; }");
+    const auto root_fn = compile(gc_heap, interned_strings, "{ var x = 42; if (x) { var x = 14; } x; }");
     const auto& chunk = root_fn->chunk;
 
     std::ostringstream os;
@@ -766,16 +903,13 @@ BOOST_AUTO_TEST_CASE(if_block_will_create_a_scope)
     const auto* expected =
         "Bytecode:\n"
         "    0 : 00 00    CONSTANT [0]            ; 42 @ 1\n"
-        "    2 : 02       TRUE                    ; true @ 1\n"
-        "    3 : 1a 00 07 JUMP_IF_FALSE +7 -> 13  ; if @ 1\n"
-        "    6 : 04       POP                     ; if @ 1\n"
+        "    2 : 05 00    GET_LOCAL [0]           ; x @ 1\n"
+        "    4 : 28 00 03 JUMP_IF_FALSE_POP +3 -> 10 ; if @ 1\n"
         "    7 : 00 01    CONSTANT [1]            ; 14 @ 1\n"
         "    9 : 04       POP                     ; } @ 1\n"
-        "   10 : 19 00 01 JUMP +1 -> 14           ; if @ 1\n"
-        "   13 : 04       POP                     ; if @ 1\n"
-        "   14 : 05 00    GET_LOCAL [0]           ; x @ 1\n"
-        "   16 : 04       POP                     ; ; @ 1\n"
-        "   17 : 04       POP                     ; } @ 1\n"
+        "   10 : 05 00    GET_LOCAL [0]           ; x @ 1\n"
+        "   12 : 04       POP                     ; ; @ 1\n"
+        "   13 : 04       POP                     ; } @ 1\n"
         "Constants:\n"
         "    0 : 42\n"
         "    1 : 14\n";
@@ -800,22 +934,15 @@ BOOST_AUTO_TEST_CASE(for_loops_will_compile)
         "    0 : 00 00    CONSTANT [0]            ; 0 @ 1\n"
         "    2 : 05 00    GET_LOCAL [0]           ; x @ 1\n"
         "    4 : 00 01    CONSTANT [1]            ; 3 @ 1\n"
-        "    6 : 0f       EQUAL                   ; != @ 1\n"
-        "    7 : 16       NOT                     ; != @ 1\n"
-        "    8 : 1a 00 14 JUMP_IF_FALSE +20 -> 31 ; for @ 1\n"
-        "   11 : 19 00 0b JUMP +11 -> 25          ; for @ 1\n"
-        "   14 : 05 00    GET_LOCAL [0]           ; x @ 1\n"
-        "   16 : 00 02    CONSTANT [2]            ; 1 @ 1\n"
-        "   18 : 12       ADD                     ; + @ 1\n"
-        "   19 : 06 00    SET_LOCAL [0]           ; x @ 1\n"
-        "   21 : 04       POP                     ; for @ 1\n"
-        "   22 : 1b 00 17 LOOP -23 -> 2           ; for @ 1\n"
-        "   25 : 04       POP                     ; for @ 1\n"
-        "   26 : 01       NIL                     ; nil @ 1\n"
-        "   27 : 04       POP                     ; ; @ 1\n"
-        "   28 : 1b 00 11 LOOP -17 -> 14          ; for @ 1\n"
-        "   31 : 04       POP                     ; for @ 1\n"
-        "   32 : 04       POP                     ; for @ 1\n"
+        "    6 : 27       NOT_EQUAL               ; != @ 1\n"
+        "    7 : 28 00 0e JUMP_IF_FALSE_POP +14 -> 24 ; for @ 1\n"
+        "   10 : 19 00 06 JUMP +6 -> 19           ; for @ 1\n"
+        "   13 : 29 00 02 ADD_LOCAL_CONSTANT [0] [2] ; + @ 1\n"
+        "   16 : 1b 00 11 LOOP -17 -> 2           ; for @ 1\n"
+        "   19 : 01       NIL                     ; nil @ 1\n"
+        "   20 : 04       POP                     ; ; @ 1\n"
+        "   21 : 1b 00 0b LOOP -11 -> 13          ; for @ 1\n"
+        "   24 : 04       POP                     ; for @ 1\n"
         "Constants:\n"
         "    0 : 0\n"
         "    1 : 3\n"
@@ -838,15 +965,9 @@ BOOST_AUTO_TEST_CASE(for_loop_init_condition_increment_can_be_blank)
     // clang-format off
     const auto* expected =
         "Bytecode:\n"
-        "    0 : 02       TRUE                    ; for @ 1\n"
-        "    1 : 1a 00 0c JUMP_IF_FALSE +12 -> 16 ; for @ 1\n"
-        "    4 : 19 00 03 JUMP +3 -> 10           ; for @ 1\n"
-        "    7 : 1b 00 0a LOOP -10 -> 0           ; for @ 1\n"
-        "   10 : 04       POP                     ; for @ 1\n"
-        "   11 : 01       NIL                     ; nil @ 1\n"
-        "   12 : 04       POP                     ; ; @ 1\n"
-        "   13 : 1b 00 09 LOOP -9 -> 7            ; for @ 1\n"
-        "   16 : 04       POP                     ; for @ 1\n"
+        "    0 : 01       NIL                     ; nil @ 1\n"
+        "    1 : 04       POP                     ; ; @ 1\n"
+        "    2 : 1b 00 05 LOOP -5 -> 0            ; for @ 1\n"
         "Constants:\n"
         "    -\n";
     // clang-format on
@@ -854,6 +975,43 @@ BOOST_AUTO_TEST_CASE(for_loop_init_condition_increment_can_be_blank)
     BOOST_TEST(os.str() == expected);
 }
 
+BOOST_AUTO_TEST_CASE(constant_conditions_will_prune_dead_branches)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    const auto root_fn = compile(
+        gc_heap,
+        interned_strings,
+        "if (false) print 1; else print 2;\n"
+        "while (nil) print 3;\n"
+        "for (var i = 0; 1 < 2; i = i + 1) print i;\n"
+    );
+    const auto& chunk = root_fn->chunk;
+
+    std::ostringstream os;
+    os << chunk;
+
+    // clang-format off
+    const auto* expected =
+        "Bytecode:\n"
+        "    0 : 00 00    CONSTANT [0]            ; 2 @ 1\n"
+        "    2 : 18       PRINT                   ; print @ 1\n"
+        "    3 : 00 01    CONSTANT [1]            ; 0 @ 3\n"
+        "    5 : 19 00 03 JUMP +3 -> 11           ; for @ 3\n"
+        "    8 : 29 00 02 ADD_LOCAL_CONSTANT [0] [2] ; + @ 3\n"
+        "   11 : 05 00    GET_LOCAL [0]           ; i @ 3\n"
+        "   13 : 18       PRINT                   ; print @ 3\n"
+        "   14 : 1b 00 09 LOOP -9 -> 8            ; for @ 3\n"
+        "   17 : 04       POP                     ; for @ 3\n"
+        "Constants:\n"
+        "    0 : 2\n"
+        "    1 : 0\n"
+        "    2 : 1\n";
+    // clang-format on
+
+    BOOST_TEST(os.str() == expected);
+}
+
 BOOST_AUTO_TEST_CASE(for_loop_vars_will_be_local)
 {
     motts::lox::GC_heap gc_heap;
@@ -871,23 +1029,16 @@ BOOST_AUTO_TEST_CASE(for_loop_vars_will_be_local)
         "    2 : 00 01    CONSTANT [1]            ; 0 @ 1\n"
         "    4 : 05 01    GET_LOCAL [1]           ; x @ 1\n"
         "    6 : 00 02    CONSTANT [2]            ; 3 @ 1\n"
-        "    8 : 0f       EQUAL                   ; != @ 1\n"
-        "    9 : 16       NOT                     ; != @ 1\n"
-        "   10 : 1a 00 14 JUMP_IF_FALSE +20 -> 33 ; for @ 1\n"
-        "   13 : 19 00 0b JUMP +11 -> 27          ; for @ 1\n"
-        "   16 : 05 01    GET_LOCAL [1]           ; x @ 1\n"
-        "   18 : 00 03    CONSTANT [3]            ; 1 @ 1\n"
-        "   20 : 12       ADD                     ; + @ 1\n"
-        "   21 : 06 01    SET_LOCAL [1]           ; x @ 1\n"
-        "   23 : 04       POP                     ; for @ 1\n"
-        "   24 : 1b 00 17 LOOP -23 -> 4           ; for @ 1\n"
-        "   27 : 04       POP                     ; for @ 1\n"
-        "   28 : 01       NIL                     ; nil @ 1\n"
-        "   29 : 04       POP                     ; ; @ 1\n"
-        "   30 : 1b 00 11 LOOP -17 -> 16          ; for @ 1\n"
-        "   33 : 04       POP                     ; for @ 1\n"
-        "   34 : 04       POP                     ; for @ 1\n"
-        "   35 : 04       POP                     ; } @ 1\n"
+        "    8 : 27       NOT_EQUAL               ; != @ 1\n"
+        "    9 : 28 00 0e JUMP_IF_FALSE_POP +14 -> 26 ; for @ 1\n"
+        "   12 : 19 00 06 JUMP +6 -> 21           ; for @ 1\n"
+        "   15 : 29 01 03 ADD_LOCAL_CONSTANT [1] [3] ; + @ 1\n"
+        "   18 : 1b 00 11 LOOP -17 -> 4           ; for @ 1\n"
+        "   21 : 01       NIL                     ; nil @ 1\n"
+        "   22 : 04       POP                     ; ; @ 1\n"
+        "   23 : 1b 00 0b LOOP -11 -> 15          ; for @ 1\n"
+        "   26 : 04       POP                     ; for @ 1\n"
+        "   27 : 04       POP                     ; } @ 1\n"
         "Constants:\n"
         "    0 : 42\n"
         "    1 : 0\n"
@@ -1606,10 +1757,9 @@ BOOST_AUTO_TEST_CASE(class_methods_can_access_and_capture_this)
         // Klass().method()();
         "    9 : 07 00    GET_GLOBAL [0]          ; Klass @ 9\n"
         "   11 : 1c 00    CALL (0)                ; Klass @ 9\n"
-        "   13 : 0c 02    GET_PROPERTY [2]        ; method @ 9\n"
-        "   15 : 1c 00    CALL (0)                ; method @ 9\n"
-        "   17 : 1c 00    CALL (0)                ; method @ 9\n"
-        "   19 : 04       POP                     ; ; @ 9\n"
+        "   13 : 1d 02 00 INVOKE [2] (0)          ; method @ 9\n"
+        "   16 : 1c 00    CALL (0)                ; method @ 9\n"
+        "   18 : 04       POP                     ; ; @ 9\n"
         "Constants:\n"
         "    0 : Klass\n"
         "    1 : <fn method>\n"
@@ -1833,11 +1983,10 @@ BOOST_AUTO_TEST_CASE(subclass_can_access_super)
         "Bytecode:\n"
         "    0 : 05 00    GET_LOCAL [0]           ; this @ 6\n"
         "    2 : 0a 00    GET_UPVALUE [0]         ; super @ 6\n"
-        "    4 : 0e 00    GET_SUPER [0]           ; method @ 6\n"
-        "    6 : 1c 00    CALL (0)                ; super @ 6\n"
-        "    8 : 04       POP                     ; ; @ 6\n"
-        "    9 : 01       NIL                     ; method @ 5\n"
-        "   10 : 21       RETURN                  ; method @ 5\n"
+        "    4 : 1e 00 00 SUPER_INVOKE [0] (0)    ; super @ 6\n"
+        "    7 : 04       POP                     ; ; @ 6\n"
+        "    8 : 01       NIL                     ; method @ 5\n"
+        "    9 : 21       RETURN                  ; method @ 5\n"
         "Constants:\n"
         "    0 : method\n";
     // clang-format on
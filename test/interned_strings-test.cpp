@@ -1,10 +1,12 @@
 #define BOOST_TEST_MODULE Interned Strings Tests
 
 #include <string>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
 #include "../src/interned_strings.hpp"
+#include "../src/object.hpp"
 
 BOOST_AUTO_TEST_CASE(interned_string_views_make_owning_copy_and_dedup)
 {
@@ -14,8 +16,10 @@ BOOST_AUTO_TEST_CASE(interned_string_views_make_owning_copy_and_dedup)
     std::string_view str_view{"hello"};
     const auto interned_str_gc_ptr = interned_strings.get(str_view);
 
-    BOOST_TEST(*interned_str_gc_ptr == str_view);
-    BOOST_TEST(reinterpret_cast<const void*>(&*(interned_str_gc_ptr->cbegin())) != reinterpret_cast<const void*>(&*(str_view.cbegin())));
+    BOOST_TEST(interned_str_gc_ptr->chars() == str_view);
+    BOOST_TEST(
+        reinterpret_cast<const void*>(&*(interned_str_gc_ptr->chars().cbegin())) != reinterpret_cast<const void*>(&*(str_view.cbegin()))
+    );
 
     std::string_view str_view_2{"hello"};
     const auto interned_str_gc_ptr_2 = interned_strings.get(str_view_2);
@@ -43,3 +47,80 @@ BOOST_AUTO_TEST_CASE(interned_strings_are_weakref_and_delete_if_collected)
 
     BOOST_TEST(gc_ptr_after_collect != gc_ptr_not_marked);
 }
+
+BOOST_AUTO_TEST_CASE(interned_strings_wont_return_dead_strings_waiting_to_be_swept)
+{
+    // With no minimum heap, the first due collection is full, and its sweep is lazy.
+    motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ 0};
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    const auto gc_ptr_dead = interned_strings.get("hello");
+    gc_heap.collect_garbage_if_due();
+
+    BOOST_TEST(gc_heap.sweeping() == true);
+    BOOST_TEST(gc_heap.is_dead(*gc_ptr_dead.control_block) == true);
+
+    const auto gc_ptr_new = interned_strings.get("hello");
+
+    BOOST_TEST(gc_ptr_new != gc_ptr_dead);
+    BOOST_TEST(gc_heap.is_dead(*gc_ptr_new.control_block) == false);
+
+    // Sweeping the dead string mustn't forget the new one.
+    while (gc_heap.sweeping()) {
+        gc_heap.collect_garbage_if_due();
+    }
+
+    BOOST_TEST(interned_strings.get("hello") == gc_ptr_new);
+}
+
+BOOST_AUTO_TEST_CASE(young_collections_forget_only_unreachable_young_strings)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    const auto gc_ptr_old = interned_strings.get("old");
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, gc_ptr_old); });
+    gc_heap.collect_young_garbage();
+    gc_heap.on_mark_roots.pop_back();
+
+    const auto gc_ptr_young = interned_strings.get("young");
+    gc_heap.collect_young_garbage();
+
+    // The old string isn't marked by a young collection, but it's still alive and still interned.
+    BOOST_TEST(interned_strings.get("old") == gc_ptr_old);
+
+    interned_strings.get("dummy");
+    BOOST_TEST(interned_strings.get("young") != gc_ptr_young);
+}
+
+BOOST_AUTO_TEST_CASE(interned_strings_stay_found_as_the_table_grows_and_forgets)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    std::vector<motts::lox::GC_ptr<const motts::lox::String>> kept_gc_ptrs;
+    for (auto i = 0; i != 1000; ++i) {
+        const auto gc_ptr = interned_strings.get(std::to_string(i));
+        if (i % 2 == 0) {
+            kept_gc_ptrs.push_back(gc_ptr);
+        }
+    }
+    gc_heap.on_mark_roots.push_back([&] {
+        for (const auto& gc_ptr : kept_gc_ptrs) {
+            mark(gc_heap, gc_ptr);
+        }
+    });
+
+    gc_heap.collect_young_garbage();
+    for (auto i = 0; i != 1000; i += 2) {
+        BOOST_TEST(interned_strings.get(std::to_string(i)) == kept_gc_ptrs[i / 2]);
+    }
+
+    kept_gc_ptrs.resize(kept_gc_ptrs.size() / 2);
+    gc_heap.collect_garbage();
+    for (auto i = 0; i != 500; i += 2) {
+        BOOST_TEST(interned_strings.get(std::to_string(i)) == kept_gc_ptrs[i / 2]);
+    }
+
+    gc_heap.on_mark_roots.pop_back();
+}
@@ -1,10 +1,15 @@
 #define BOOST_TEST_MODULE Memory Tests
 
+#include <array>
 #include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
 #include "../src/memory.hpp"
+#include "../src/object.hpp"
 
 struct Destruct_tracer
 {
@@ -40,12 +45,17 @@ void motts::lox::trace_refs_trait(motts::lox::GC_heap&, const Destruct_tracer& t
     *tracer.os << tracer.name << "::trace_refs\n";
 }
 
-BOOST_AUTO_TEST_CASE(control_block_wraps_value_with_marked_flag)
+BOOST_AUTO_TEST_CASE(control_block_wraps_value)
 {
     motts::lox::GC_control_block<int> control_block_int{42};
 
     BOOST_TEST(control_block_int.value == 42);
-    BOOST_TEST(control_block_int.marked == false);
+}
+
+BOOST_AUTO_TEST_CASE(control_block_header_is_smaller_than_a_pointer)
+{
+    BOOST_TEST(std::is_polymorphic_v<motts::lox::GC_control_block<int>> == false);
+    BOOST_TEST(sizeof(motts::lox::GC_control_block<void*>) == 2 * sizeof(void*));
 }
 
 BOOST_AUTO_TEST_CASE(gc_ptr_wraps_control_block)
@@ -99,11 +109,11 @@ BOOST_AUTO_TEST_CASE(control_blocks_and_gc_ptrs_can_be_marked)
     motts::lox::GC_heap gc_heap;
     auto gc_ptr_int = gc_heap.make<int>(42);
 
-    BOOST_TEST(gc_ptr_int.control_block->marked == false);
+    BOOST_TEST(gc_heap.marked(*gc_ptr_int.control_block) == false);
 
     mark(gc_heap, gc_ptr_int);
 
-    BOOST_TEST(gc_ptr_int.control_block->marked == true);
+    BOOST_TEST(gc_heap.marked(*gc_ptr_int.control_block) == true);
 }
 
 BOOST_AUTO_TEST_CASE(gc_heap_collect_will_invoke_trace_refs_trait)
@@ -152,3 +162,447 @@ BOOST_AUTO_TEST_CASE(gc_heap_will_report_current_allocation_size)
 
     BOOST_TEST(gc_heap.size() == sizeof(motts::lox::GC_control_block<int>) * 1);
 }
+
+BOOST_AUTO_TEST_CASE(gc_heap_will_reuse_memory_of_collected_objects)
+{
+    motts::lox::GC_heap gc_heap;
+    const auto gc_ptr_collected = gc_heap.make<int>(42);
+    const auto* collected_control_block = gc_ptr_collected.control_block;
+
+    gc_heap.collect_garbage();
+
+    const auto gc_ptr_reused = gc_heap.make<int>(43);
+
+    BOOST_TEST(static_cast<const void*>(gc_ptr_reused.control_block) == static_cast<const void*>(collected_control_block));
+    BOOST_TEST(*gc_ptr_reused == 43);
+}
+
+struct Large_destruct_tracer
+{
+    Destruct_tracer tracer;
+    std::array<char, 1024> padding{};
+};
+
+BOOST_AUTO_TEST_CASE(gc_heap_will_make_and_destroy_objects_larger_than_pooled_sizes)
+{
+    std::ostringstream os;
+    {
+        motts::lox::GC_heap gc_heap;
+        auto gc_ptr_small = gc_heap.make<Destruct_tracer>({os, "Small"});
+        auto gc_ptr_large = gc_heap.make<Large_destruct_tracer>({Destruct_tracer{os, "Large"}});
+
+        mark(gc_heap, gc_ptr_small);
+        static_cast<void>(gc_ptr_large); // Suppress unused variable error.
+        gc_heap.collect_garbage();
+
+        BOOST_TEST(os.str() == "Small::trace_refs\n~Large\n");
+    }
+
+    BOOST_TEST(os.str() == "Small::trace_refs\n~Large\n~Small\n");
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_will_keep_marked_objects_larger_than_pooled_sizes)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    auto gc_ptr_large = gc_heap.make<Large_destruct_tracer>({Destruct_tracer{os, "Large"}});
+
+    mark(gc_heap, gc_ptr_large);
+    gc_heap.collect_garbage();
+
+    BOOST_TEST(os.str() == "");
+    BOOST_TEST(gc_heap.marked(*gc_ptr_large.control_block) == false);
+
+    gc_heap.collect_garbage();
+
+    BOOST_TEST(os.str() == "~Large\n");
+}
+
+BOOST_AUTO_TEST_CASE(lox_objects_will_be_pool_allocated)
+{
+    using motts::lox::GC_control_block;
+    constexpr auto max_pooled_size = motts::lox::Pool_allocator::max_pooled_size;
+
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Bound_method>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Class>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Closure>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Function>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Instance>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Native_fn>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Shape>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<const motts::lox::String>) <= max_pooled_size);
+    BOOST_TEST(sizeof(GC_control_block<motts::lox::Upvalue>) <= max_pooled_size);
+}
+
+struct Linked_tracer
+{
+    Destruct_tracer tracer;
+    motts::lox::GC_ptr<Destruct_tracer> next;
+};
+
+template<>
+void motts::lox::trace_refs_trait(motts::lox::GC_heap& gc_heap, const Linked_tracer& linked_tracer)
+{
+    mark(gc_heap, linked_tracer.next);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_young_collect_will_destroy_only_young_unmarked_objects)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    auto gc_ptr_old = gc_heap.make<Destruct_tracer>({os, "Old"});
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, gc_ptr_old); });
+
+    // Surviving a collection promotes to old.
+    gc_heap.collect_young_garbage();
+    gc_heap.on_mark_roots.clear();
+    auto gc_ptr_young = gc_heap.make<Destruct_tracer>({os, "Young"});
+    static_cast<void>(gc_ptr_young); // Suppress unused variable error.
+
+    BOOST_TEST(gc_heap.young_size() == sizeof(motts::lox::GC_control_block<Destruct_tracer>));
+
+    os.str("");
+    gc_heap.collect_young_garbage();
+
+    BOOST_TEST(os.str() == "~Young\n");
+    BOOST_TEST(gc_heap.young_size() == 0);
+
+    os.str("");
+    gc_heap.collect_garbage();
+
+    BOOST_TEST(os.str() == "~Old\n");
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_young_collect_will_trace_old_objects_after_write_barrier)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    auto gc_ptr_old = gc_heap.make<Linked_tracer>({Destruct_tracer{os, "Old"}, {}});
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, gc_ptr_old); });
+    gc_heap.collect_young_garbage();
+
+    write_barrier(gc_heap, gc_ptr_old);
+    gc_ptr_old->next = gc_heap.make<Destruct_tracer>({os, "Young"});
+
+    os.str("");
+    gc_heap.collect_young_garbage();
+
+    BOOST_TEST(os.str() == "Young::trace_refs\n");
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_collection_thresholds_will_scale_by_growth_factor)
+{
+    constexpr auto block_size = sizeof(motts::lox::GC_control_block<int>);
+    motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ block_size * 2};
+    std::vector<motts::lox::GC_ptr<int>> roots;
+    gc_heap.on_mark_roots.push_back([&] {
+        for (const auto& root : roots) {
+            mark(gc_heap, root);
+        }
+    });
+
+    roots.push_back(gc_heap.make<int>(1));
+    roots.push_back(gc_heap.make<int>(2));
+
+    BOOST_TEST(gc_heap.collection_due() == false);
+
+    roots.push_back(gc_heap.make<int>(3));
+
+    BOOST_TEST(gc_heap.collection_due() == true);
+    BOOST_TEST(gc_heap.full_collection_due() == true);
+
+    // All 3 survive, so the next full collection is due past 6. That's known once the lazy sweep finishes.
+    gc_heap.collect_garbage_if_due();
+    while (gc_heap.sweeping()) {
+        gc_heap.collect_garbage_if_due();
+    }
+
+    BOOST_TEST(gc_heap.collection_due() == false);
+
+    roots.push_back(gc_heap.make<int>(4));
+    roots.push_back(gc_heap.make<int>(5));
+    roots.push_back(gc_heap.make<int>(6));
+
+    BOOST_TEST(gc_heap.collection_due() == true);
+    BOOST_TEST(gc_heap.full_collection_due() == false);
+
+    roots.push_back(gc_heap.make<int>(7));
+
+    BOOST_TEST(gc_heap.full_collection_due() == true);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_growth_factor_less_than_one_will_throw)
+{
+    BOOST_CHECK_THROW(motts::lox::GC_heap{0.5}, std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_incremental_marking_will_retrace_black_objects_after_write_barrier)
+{
+    std::ostringstream os;
+
+    // With no minimum heap, every check is due for a full collection, and a budget of 1 traces one object per slice.
+    motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ 0, /* mark_slice_budget = */ 1};
+    auto gc_ptr_gray = gc_heap.make<Linked_tracer>({Destruct_tracer{os, "Gray"}, gc_heap.make<Destruct_tracer>({os, "White"})});
+    auto gc_ptr_black = gc_heap.make<Linked_tracer>({Destruct_tracer{os, "Black"}, {}});
+    gc_heap.make<Destruct_tracer>({os, "Garbage"});
+    gc_heap.on_mark_roots.push_back([&] {
+        mark(gc_heap, gc_ptr_gray);
+        mark(gc_heap, gc_ptr_black);
+    });
+
+    // The worklist is last in, first out, so the first slice traces only "Black".
+    gc_heap.collect_garbage_if_due();
+
+    BOOST_TEST(gc_heap.incremental_marking() == true);
+    BOOST_TEST(gc_heap.traced(*gc_ptr_black.control_block) == true);
+    BOOST_TEST(gc_heap.traced(*gc_ptr_gray.control_block) == false);
+
+    // Move the only reference to "White" from the gray object to the black object.
+    write_barrier(gc_heap, gc_ptr_black);
+    gc_ptr_black->next = gc_ptr_gray->next;
+    write_barrier(gc_heap, gc_ptr_gray);
+    gc_ptr_gray->next = {};
+
+    while (gc_heap.incremental_marking() || gc_heap.sweeping()) {
+        gc_heap.collect_garbage_if_due();
+    }
+
+    BOOST_TEST(os.str() == "White::trace_refs\n~Garbage\n");
+}
+
+struct Tree_node
+{
+    std::vector<motts::lox::GC_ptr<Tree_node>> children;
+};
+
+template<>
+void motts::lox::trace_refs_trait(motts::lox::GC_heap& gc_heap, const Tree_node& node)
+{
+    for (const auto& child : node.children) {
+        mark(gc_heap, child);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_parallel_marking_will_keep_the_same_objects_as_serial_marking)
+{
+    for (const std::size_t n_mark_threads : {1, 4}) {
+        motts::lox::GC_heap gc_heap{
+            motts::lox::GC_heap::default_growth_factor,
+            motts::lox::GC_heap::default_min_heap_size,
+            motts::lox::GC_heap::default_mark_slice_budget,
+            n_mark_threads
+        };
+
+        // A reachable binary tree of depth 12, and an unreachable one of depth 10.
+        const auto make_tree = [&](const auto& make_tree, int depth) -> motts::lox::GC_ptr<Tree_node> {
+            auto node = gc_heap.make<Tree_node>({});
+            if (depth > 0) {
+                node->children.push_back(make_tree(make_tree, depth - 1));
+                node->children.push_back(make_tree(make_tree, depth - 1));
+            }
+            return node;
+        };
+        const auto root = make_tree(make_tree, 12);
+        make_tree(make_tree, 10);
+        gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, root); });
+
+        gc_heap.collect_garbage();
+
+        BOOST_TEST(gc_heap.size() == sizeof(motts::lox::GC_control_block<Tree_node>) * ((1 << 13) - 1));
+    }
+}
+
+struct Chain_node
+{
+    int value;
+    motts::lox::GC_ptr<Chain_node> next;
+};
+
+template<>
+void motts::lox::trace_refs_trait(motts::lox::GC_heap& gc_heap, const Chain_node& chain_node)
+{
+    mark(gc_heap, chain_node.next);
+}
+
+template<>
+void motts::lox::update_refs_trait(motts::lox::GC_heap& gc_heap, Chain_node& chain_node)
+{
+    update_ref(gc_heap, chain_node.next);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_compact_will_move_survivors_and_update_refs)
+{
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 0,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0.5
+    };
+
+    // Keep every tenth node in a chain, so the survivors are spread thinly over many pages.
+    motts::lox::GC_ptr<Chain_node> head;
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, head); });
+    gc_heap.on_update_roots.push_back([&] { update_ref(gc_heap, head); });
+    for (int i = 0; i != 10'000; ++i) {
+        auto node = gc_heap.make<Chain_node>({i, {}});
+        if (i % 10 == 0) {
+            node->next = head;
+            head = node;
+        }
+    }
+
+    gc_heap.collect_garbage();
+
+    BOOST_TEST(gc_heap.compaction_due() == true);
+    const auto old_head = head;
+    const auto reserved_size_before = gc_heap.reserved_size();
+
+    gc_heap.compact();
+
+    BOOST_TEST(head != old_head);
+    BOOST_TEST(gc_heap.reserved_size() < reserved_size_before);
+    BOOST_TEST(gc_heap.size() == sizeof(motts::lox::GC_control_block<Chain_node>) * 1'000);
+    BOOST_TEST(gc_heap.compaction_due() == false);
+
+    int expected_value = 9'990;
+    for (auto node = head; node; node = node->next) {
+        BOOST_TEST(node->value == expected_value);
+        expected_value -= 10;
+    }
+    BOOST_TEST(expected_value == -10);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_compact_threshold_of_one_will_throw)
+{
+    BOOST_CHECK_THROW((motts::lox::GC_heap{2.0, 0, 0, 1, 1.0}), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_stats_will_count_collections_bytes_and_live_objects)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    auto gc_ptr_live = gc_heap.make<Destruct_tracer>({os, "Live"});
+    gc_heap.make<Destruct_tracer>({os, "Dead"});
+    gc_heap.make<int>(42);
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, gc_ptr_live); });
+
+    std::size_t n_collection_ends{0};
+    gc_heap.on_collection_end.push_back([&] { ++n_collection_ends; });
+
+    gc_heap.collect_young_garbage();
+    gc_heap.collect_garbage();
+
+    const auto stats = gc_heap.stats();
+    const auto tracer_size = sizeof(motts::lox::GC_control_block<Destruct_tracer>);
+    const auto int_size = sizeof(motts::lox::GC_control_block<int>);
+
+    BOOST_TEST(n_collection_ends == 2);
+    BOOST_TEST(stats.n_young_collections == 1);
+    BOOST_TEST(stats.n_full_collections == 1);
+    BOOST_TEST(stats.n_pauses == 2);
+    BOOST_TEST(stats.max_pause_time <= stats.total_pause_time);
+    BOOST_TEST(stats.total_allocated_objects == 3);
+    BOOST_TEST(stats.total_freed_objects == 2);
+    BOOST_TEST(stats.total_allocated_bytes == tracer_size * 2 + int_size);
+    BOOST_TEST(stats.total_freed_bytes == tracer_size + int_size);
+    BOOST_TEST(stats.live_bytes == tracer_size);
+    BOOST_TEST(stats.live_objects_by_type.size() == 1);
+    BOOST_TEST(stats.live_objects_by_type.at(0).type_name == "Destruct_tracer");
+    BOOST_TEST(stats.live_objects_by_type.at(0).n_objects == 1);
+    BOOST_TEST(stats.live_objects_by_size.size() == 1);
+    BOOST_TEST(stats.live_objects_by_size.at(0).object_size == tracer_size);
+
+    std::ostringstream json;
+    print_json(json, stats);
+
+    BOOST_TEST(json.str().find("\"live_objects_by_type\": [\n        {\"type\": \"Destruct_tracer\", \"n_objects\": 1") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_over_limit_will_collect_and_throw_only_if_still_over)
+{
+    std::ostringstream os;
+    const auto tracer_size = sizeof(motts::lox::GC_control_block<Destruct_tracer>);
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 1024 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0,
+        /* max_heap_size = */ tracer_size * 2
+    };
+    std::vector<motts::lox::GC_ptr<Destruct_tracer>> roots;
+    gc_heap.on_mark_roots.push_back([&] {
+        for (const auto root : roots) {
+            mark(gc_heap, root);
+        }
+    });
+
+    // Garbage puts the heap over its limit, but an emergency collection frees enough.
+    roots.push_back(gc_heap.make<Destruct_tracer>({os, "Live1"}));
+    gc_heap.make<Destruct_tracer>({os, "Dead1"});
+    gc_heap.make<Destruct_tracer>({os, "Dead2"});
+
+    BOOST_TEST(gc_heap.collection_due() == true);
+    BOOST_CHECK_NO_THROW(gc_heap.collect_garbage_if_due());
+    BOOST_TEST(gc_heap.over_limit() == false);
+    BOOST_TEST(os.str() == "Live1::trace_refs\n~Dead1\n~Dead2\n");
+
+    // Live objects alone put the heap over its limit.
+    roots.push_back(gc_heap.make<Destruct_tracer>({os, "Live2"}));
+    roots.push_back(gc_heap.make<Destruct_tracer>({os, "Live3"}));
+
+    BOOST_CHECK_THROW(gc_heap.collect_garbage_if_due(), motts::lox::GC_heap_limit_error);
+    BOOST_TEST(gc_heap.size() == tracer_size * 3);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_zero_mark_threads_will_throw)
+{
+    BOOST_CHECK_THROW((motts::lox::GC_heap{2.0, 0, 0, 0}), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_due_full_collection_will_sweep_lazily)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ 0};
+    auto gc_ptr_live = gc_heap.make<Destruct_tracer>({os, "Live"});
+    gc_heap.make<Destruct_tracer>({os, "Dead"});
+    gc_heap.on_mark_roots.push_back([&] { mark(gc_heap, gc_ptr_live); });
+
+    gc_heap.collect_garbage_if_due();
+
+    BOOST_TEST(os.str() == "Live::trace_refs\n");
+    BOOST_TEST(gc_heap.sweeping() == true);
+
+    // The survivor stays marked until the sweep is done.
+    BOOST_TEST(gc_heap.is_dead(*gc_ptr_live.control_block) == false);
+
+    gc_heap.collect_garbage_if_due();
+
+    BOOST_TEST(os.str() == "Live::trace_refs\n~Dead\n");
+    BOOST_TEST(gc_heap.sweeping() == false);
+    BOOST_TEST(gc_heap.size() == sizeof(motts::lox::GC_control_block<Destruct_tracer>));
+}
+
+BOOST_AUTO_TEST_CASE(gc_heap_destroyed_mid_sweep_will_destroy_each_object_once)
+{
+    std::ostringstream os;
+    {
+        motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ 0};
+        for (auto i = 0; i != 300; ++i) {
+            gc_heap.make<Destruct_tracer>({os, "Dead"});
+        }
+
+        // Mark, then sweep one slice, which leaves the rest of the old list unswept.
+        gc_heap.collect_garbage_if_due();
+        gc_heap.collect_garbage_if_due();
+
+        BOOST_TEST(gc_heap.sweeping() == true);
+    }
+
+    std::string expected;
+    for (auto i = 0; i != 300; ++i) {
+        expected += "~Dead\n";
+    }
+    BOOST_TEST(os.str() == expected);
+}
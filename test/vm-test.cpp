@@ -2,6 +2,7 @@
 
 #include <sstream>
 #include <stdexcept>
+#include <string>
 #include <thread>
 
 #include <boost/test/unit_test.hpp>
@@ -15,6 +16,14 @@
 using motts::lox::Opcode;
 using Token = motts::lox::Source_map_token;
 
+// Hand-built chunks resolve their global slots the same way the compiler does.
+template<Opcode opcode>
+void emit_global(motts::lox::Chunk& chunk, motts::lox::Interned_strings& interned_strings, const char* global_name, const Token& token)
+{
+    const auto name = interned_strings.get(global_name);
+    chunk.emit<opcode>(name, interned_strings.global_slot_index(name), token);
+}
+
 BOOST_AUTO_TEST_CASE(vm_will_run_chunks_of_bytecode)
 {
     motts::lox::GC_heap gc_heap;
@@ -364,6 +373,29 @@ BOOST_AUTO_TEST_CASE(false_and_nil_are_falsey_all_else_is_truthy)
     BOOST_TEST(os.str() == "true\ntrue\nfalse\nfalse\nfalse\nfalse\n");
 }
 
+BOOST_AUTO_TEST_CASE(equality_compares_numbers_by_value_and_never_across_types)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // Holds for both the variant and the NaN-boxed value representations.
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "print 0 / 0 == 0 / 0;"
+        "print -0 == 0;"
+        "print nil == nil;"
+        "print nil == false;"
+        "print 1 == true;"
+        "print \"a\" == \"a\";"
+        "print clock == clock;"
+    ));
+
+    BOOST_TEST(os.str() == "false\ntrue\ntrue\nfalse\nfalse\ntrue\ntrue\n");
+}
+
 BOOST_AUTO_TEST_CASE(pop_will_run)
 {
     motts::lox::GC_heap gc_heap;
@@ -560,34 +592,33 @@ BOOST_AUTO_TEST_CASE(if_else_will_leave_clean_stack)
     motts::lox::Interned_strings interned_strings{gc_heap};
     motts::lox::VM vm{gc_heap, interned_strings, os, /* debug = */ true};
 
-    vm.run(compile(gc_heap, interned_strings, "if (true) nil;"));
+    vm.run(compile(gc_heap, interned_strings, "var x = true; if (x) nil;"));
 
     // clang-format off
     const auto expected =
         "\n# Running chunk:\n\n"
         "Bytecode:\n"
         "    0 : 02       TRUE                    ; true @ 1\n"
-        "    1 : 1a 00 06 JUMP_IF_FALSE +6 -> 10  ; if @ 1\n"
-        "    4 : 04       POP                     ; if @ 1\n"
-        "    5 : 01       NIL                     ; nil @ 1\n"
-        "    6 : 04       POP                     ; ; @ 1\n"
-        "    7 : 19 00 01 JUMP +1 -> 11           ; if @ 1\n"
-        "   10 : 04       POP                     ; if @ 1\n"
+        "    1 : 08 00    DEFINE_GLOBAL [0]       ; var @ 1\n"
+        "    3 : 07 00    GET_GLOBAL [0]          ; x @ 1\n"
+        "    5 : 28 00 02 JUMP_IF_FALSE_POP +2 -> 10 ; if @ 1\n"
+        "    8 : 01       NIL                     ; nil @ 1\n"
+        "    9 : 04       POP                     ; ; @ 1\n"
         "Constants:\n"
-        "    -\n"
+        "    0 : x\n"
         "\n"
         "# Stack:\n"
         "    0 : true\n"
         "\n"
         "# Stack:\n"
-        "    0 : true\n"
         "\n"
         "# Stack:\n"
+        "    0 : true\n"
         "\n"
         "# Stack:\n"
-        "    0 : nil\n"
         "\n"
         "# Stack:\n"
+        "    0 : nil\n"
         "\n"
         "# Stack:\n"
         "\n";
@@ -603,11 +634,11 @@ BOOST_AUTO_TEST_CASE(set_get_global_will_run)
 
     auto root_fn = gc_heap.make<motts::lox::Function>({});
     root_fn->chunk.emit<Opcode::nil>(Token{interned_strings.get("var"), 1});
-    root_fn->chunk.emit<Opcode::define_global>(interned_strings.get("x"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("var"), 1});
     root_fn->chunk.emit_constant(42.0, Token{interned_strings.get("42"), 1});
-    root_fn->chunk.emit<Opcode::set_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+    emit_global<Opcode::set_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
     root_fn->chunk.emit<Opcode::pop>(Token{interned_strings.get(";"), 1});
-    root_fn->chunk.emit<Opcode::get_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+    emit_global<Opcode::get_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
     root_fn->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
     std::ostringstream os;
@@ -623,7 +654,7 @@ BOOST_AUTO_TEST_CASE(get_global_of_undeclared_will_throw)
     motts::lox::Interned_strings interned_strings{gc_heap};
 
     auto root_fn = gc_heap.make<motts::lox::Function>({});
-    root_fn->chunk.emit<Opcode::get_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+    emit_global<Opcode::get_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
 
     std::ostringstream os;
     motts::lox::VM vm{gc_heap, interned_strings, os};
@@ -643,7 +674,7 @@ BOOST_AUTO_TEST_CASE(set_global_of_undeclared_will_throw)
 
     auto root_fn = gc_heap.make<motts::lox::Function>({});
     root_fn->chunk.emit_constant(42.0, Token{interned_strings.get("42"), 1});
-    root_fn->chunk.emit<Opcode::set_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+    emit_global<Opcode::set_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
 
     std::ostringstream os;
     motts::lox::VM vm{gc_heap, interned_strings, os};
@@ -666,13 +697,13 @@ BOOST_AUTO_TEST_CASE(vm_state_can_persist_across_multiple_runs)
     {
         auto root_fn = gc_heap.make<motts::lox::Function>({});
         root_fn->chunk.emit_constant(42.0, Token{interned_strings.get("42"), 1});
-        root_fn->chunk.emit<Opcode::define_global>(interned_strings.get("x"), Token{interned_strings.get("var"), 1});
+        emit_global<Opcode::define_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("var"), 1});
 
         vm.run(root_fn);
     }
     {
         auto root_fn = gc_heap.make<motts::lox::Function>({});
-        root_fn->chunk.emit<Opcode::get_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+        emit_global<Opcode::get_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
         root_fn->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
         vm.run(root_fn);
@@ -713,7 +744,7 @@ BOOST_AUTO_TEST_CASE(global_var_declaration_will_run)
 
     auto root_fn = gc_heap.make<motts::lox::Function>({});
     root_fn->chunk.emit<Opcode::nil>(Token{interned_strings.get("var"), 1});
-    root_fn->chunk.emit<Opcode::define_global>(interned_strings.get("x"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("var"), 1});
 
     std::ostringstream os;
     motts::lox::VM vm{gc_heap, interned_strings, os};
@@ -729,8 +760,8 @@ BOOST_AUTO_TEST_CASE(global_var_will_initialize_from_stack)
 
     auto root_fn = gc_heap.make<motts::lox::Function>({});
     root_fn->chunk.emit_constant(42.0, Token{interned_strings.get("42"), 1});
-    root_fn->chunk.emit<Opcode::define_global>(interned_strings.get("x"), Token{interned_strings.get("var"), 1});
-    root_fn->chunk.emit<Opcode::get_global>(interned_strings.get("x"), Token{interned_strings.get("x"), 1});
+    emit_global<Opcode::define_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::get_global>(root_fn->chunk, interned_strings, "x", Token{interned_strings.get("x"), 1});
     root_fn->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
     std::ostringstream os;
@@ -1040,6 +1071,26 @@ BOOST_AUTO_TEST_CASE(calling_a_noncallable_will_throw)
     }
 }
 
+BOOST_AUTO_TEST_CASE(recursion_deeper_than_max_call_frames_will_throw)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os, /* debug = */ false, /* max_call_frames = */ 64};
+
+    vm.run(compile(gc_heap, interned_strings, "fun f(n) { if (n == 0) return 0; return 1 + f(n - 1); }"));
+    vm.run(compile(gc_heap, interned_strings, "print f(62);"));
+
+    BOOST_TEST(os.str() == "62\n");
+
+    BOOST_CHECK_THROW(vm.run(compile(gc_heap, interned_strings, "f(63);")), std::runtime_error);
+    try {
+        vm.run(compile(gc_heap, interned_strings, "f(63);"));
+    } catch (const std::exception& error) {
+        BOOST_TEST(error.what() == "[Line 1] Error at \"f\": Stack overflow.");
+    }
+}
+
 BOOST_AUTO_TEST_CASE(closure_get_set_upvalue_will_run)
 {
     std::ostringstream os;
@@ -1059,10 +1110,10 @@ BOOST_AUTO_TEST_CASE(closure_get_set_upvalue_will_run)
 
     auto fn_middle = gc_heap.make<motts::lox::Function>({});
     fn_middle->chunk.emit_closure(fn_inner_get, {motts::lox::UpUpvalue_index{0}}, Token{interned_strings.get("fun"), 1});
-    fn_middle->chunk.emit<Opcode::set_global>(interned_strings.get("get"), Token{interned_strings.get("get"), 1});
+    emit_global<Opcode::set_global>(fn_middle->chunk, interned_strings, "get", Token{interned_strings.get("get"), 1});
     fn_middle->chunk.emit<Opcode::pop>(Token{interned_strings.get(";"), 1});
     fn_middle->chunk.emit_closure(fn_inner_set, {motts::lox::UpUpvalue_index{0}}, Token{interned_strings.get("fun"), 1});
-    fn_middle->chunk.emit<Opcode::set_global>(interned_strings.get("set"), Token{interned_strings.get("set"), 1});
+    emit_global<Opcode::set_global>(fn_middle->chunk, interned_strings, "set", Token{interned_strings.get("set"), 1});
     fn_middle->chunk.emit<Opcode::pop>(Token{interned_strings.get(";"), 1});
     fn_middle->chunk.emit<Opcode::return_>(Token{interned_strings.get("return"), 1});
 
@@ -1076,16 +1127,16 @@ BOOST_AUTO_TEST_CASE(closure_get_set_upvalue_will_run)
 
     auto fn_main = gc_heap.make<motts::lox::Function>({});
     fn_main->chunk.emit<Opcode::nil>(Token{interned_strings.get("var"), 1});
-    fn_main->chunk.emit<Opcode::define_global>(interned_strings.get("get"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(fn_main->chunk, interned_strings, "get", Token{interned_strings.get("var"), 1});
     fn_main->chunk.emit<Opcode::nil>(Token{interned_strings.get("var"), 1});
-    fn_main->chunk.emit<Opcode::define_global>(interned_strings.get("set"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(fn_main->chunk, interned_strings, "set", Token{interned_strings.get("var"), 1});
     fn_main->chunk.emit_closure(fn_outer, {}, Token{interned_strings.get("fun"), 1});
     fn_main->chunk.emit_call(0, Token{interned_strings.get("outer"), 1});
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("get"), Token{interned_strings.get("get"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "get", Token{interned_strings.get("get"), 1});
     fn_main->chunk.emit_call(0, Token{interned_strings.get("get"), 1});
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("set"), Token{interned_strings.get("set"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "set", Token{interned_strings.get("set"), 1});
     fn_main->chunk.emit_call(0, Token{interned_strings.get("set"), 1});
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("get"), Token{interned_strings.get("get"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "get", Token{interned_strings.get("get"), 1});
     fn_main->chunk.emit_call(0, Token{interned_strings.get("get"), 1});
 
     vm.run(fn_main);
@@ -1156,6 +1207,31 @@ BOOST_AUTO_TEST_CASE(closure_early_return_will_close_upvalues)
     BOOST_TEST(os.str() == "42\n");
 }
 
+BOOST_AUTO_TEST_CASE(upvalues_are_closed_per_call_not_per_closure)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // A recursive call returning must not close the caller's upvalues, and a later call must start with none open.
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "fun f(n) {"
+        "    var a = n;"
+        "    fun g() { return a; }"
+        "    if (n > 0) f(n - 1);"
+        "    a = a + 10;"
+        "    print g();"
+        "}"
+        "f(1);"
+        "f(0);"
+    ));
+
+    BOOST_TEST(os.str() == "10\n11\n10\n");
+}
+
 BOOST_AUTO_TEST_CASE(class_will_run)
 {
     std::ostringstream os;
@@ -1171,24 +1247,24 @@ BOOST_AUTO_TEST_CASE(class_will_run)
     fn_main->chunk.emit<Opcode::class_>(interned_strings.get("Klass"), Token{interned_strings.get("class"), 1});
     fn_main->chunk.emit_closure(fn_method, {}, Token{interned_strings.get("method"), 1});
     fn_main->chunk.emit<Opcode::method>(interned_strings.get("method"), Token{interned_strings.get("method"), 1});
-    fn_main->chunk.emit<Opcode::define_global>(interned_strings.get("Klass"), Token{interned_strings.get("class"), 1});
+    emit_global<Opcode::define_global>(fn_main->chunk, interned_strings, "Klass", Token{interned_strings.get("class"), 1});
 
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("Klass"), Token{interned_strings.get("Klass"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "Klass", Token{interned_strings.get("Klass"), 1});
     fn_main->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("Klass"), Token{interned_strings.get("Klass"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "Klass", Token{interned_strings.get("Klass"), 1});
     fn_main->chunk.emit_call(0, Token{interned_strings.get("Klass"), 1});
-    fn_main->chunk.emit<Opcode::define_global>(interned_strings.get("instance"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(fn_main->chunk, interned_strings, "instance", Token{interned_strings.get("var"), 1});
 
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("instance"), Token{interned_strings.get("instance"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "instance", Token{interned_strings.get("instance"), 1});
     fn_main->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
     fn_main->chunk.emit_constant(42.0, Token{interned_strings.get("42"), 1});
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("instance"), Token{interned_strings.get("instance"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "instance", Token{interned_strings.get("instance"), 1});
     fn_main->chunk.emit<Opcode::set_property>(interned_strings.get("property"), Token{interned_strings.get("property"), 1});
     fn_main->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
-    fn_main->chunk.emit<Opcode::get_global>(interned_strings.get("instance"), Token{interned_strings.get("instance"), 1});
+    emit_global<Opcode::get_global>(fn_main->chunk, interned_strings, "instance", Token{interned_strings.get("instance"), 1});
     fn_main->chunk.emit<Opcode::get_property>(interned_strings.get("property"), Token{interned_strings.get("property"), 1});
     fn_main->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 
@@ -1401,23 +1477,438 @@ BOOST_AUTO_TEST_CASE(super_calls_will_run)
     BOOST_TEST(os.str() == "Child\nParent\n");
 }
 
+BOOST_AUTO_TEST_CASE(invoke_calls_fields_and_methods_with_arguments)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // A field shadows a method of the same name, and super calls pass their arguments through.
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "class Parent {"
+        "    add(a, b) { return a + b; }"
+        "}"
+        "class Child < Parent {"
+        "    add(a, b) { return super.add(a, b) * 10; }"
+        "}"
+        "fun sub(a, b) { return a - b; }"
+        "var child = Child();"
+        "print child.add(1, 2);"
+        "child.add = sub;"
+        "print child.add(1, 2);"
+        "child.add = Parent;"
+        "print child.add;"
+    ));
+
+    BOOST_TEST(os.str() == "30\n-1\n<class Parent>\n");
+
+    try {
+        vm.run(compile(gc_heap, interned_strings, "child.missing(1);"));
+        BOOST_FAIL("Expected an undefined property error.");
+    } catch (const std::runtime_error& error) {
+        BOOST_TEST(error.what() == "[Line 1] Error: Undefined property \"missing\".");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(instances_share_shapes_when_fields_are_added_in_the_same_order)
+{
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+
+    const auto klass = gc_heap.make<motts::lox::Class>({interned_strings.get("Klass"), gc_heap.make<motts::lox::Shape>({})});
+    auto xy_1 = gc_heap.make<motts::lox::Instance>({klass});
+    auto xy_2 = gc_heap.make<motts::lox::Instance>({klass});
+    auto yx = gc_heap.make<motts::lox::Instance>({klass});
+
+    xy_1->set_field(gc_heap, interned_strings.get("x"), 1.0);
+    xy_1->set_field(gc_heap, interned_strings.get("y"), 2.0);
+    xy_2->set_field(gc_heap, interned_strings.get("x"), 3.0);
+    xy_2->set_field(gc_heap, interned_strings.get("y"), 4.0);
+    xy_2->set_field(gc_heap, interned_strings.get("x"), 5.0);
+    yx->set_field(gc_heap, interned_strings.get("y"), 6.0);
+    yx->set_field(gc_heap, interned_strings.get("x"), 7.0);
+
+    BOOST_TEST((xy_1->shape == xy_2->shape));
+    BOOST_TEST(! (xy_1->shape == yx->shape));
+    BOOST_TEST(xy_2->fields.size() == 2);
+    BOOST_TEST(*xy_2->find_field(interned_strings.get("x")) == motts::lox::Dynamic_type_value{5.0});
+    BOOST_TEST(*yx->find_field(interned_strings.get("x")) == motts::lox::Dynamic_type_value{7.0});
+    BOOST_TEST(! yx->find_field(interned_strings.get("z")));
+}
+
+BOOST_AUTO_TEST_CASE(property_inline_caches_will_hit_for_the_same_shape)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "class Point {"
+        "    init(x) { this.x = x; }"
+        "    getX() { return this.x; }"
+        "}"
+        "var sum = 0;"
+        "for (var i = 0; i < 4; i = i + 1) {"
+        "    var point = Point(i);"
+        "    sum = sum + point.x + point.getX();"
+        "}"
+        "print sum;"
+    ));
+
+    BOOST_TEST(os.str() == "12\n");
+
+    // Each site misses once on the first instance, then every later instance has the same shape.
+    const auto& stats = vm.inline_cache_stats();
+    BOOST_TEST(stats.get_property.hits == 6);
+    BOOST_TEST(stats.get_property.misses == 2);
+    BOOST_TEST(stats.set_property.hits == 3);
+    BOOST_TEST(stats.set_property.misses == 1);
+    BOOST_TEST(stats.invoke.hits == 3);
+    BOOST_TEST(stats.invoke.misses == 1);
+}
+
+BOOST_AUTO_TEST_CASE(global_slots_are_shared_across_compiles_and_may_be_defined_late)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // Compiling `later` gives it a slot before any script defines it.
+    vm.run(compile(gc_heap, interned_strings, "fun f() { return later; }"));
+    try {
+        vm.run(compile(gc_heap, interned_strings, "print f();"));
+        BOOST_FAIL("Expected an undefined variable error.");
+    } catch (const std::runtime_error& error) {
+        BOOST_TEST(error.what() == "[Line 1] Error: Undefined variable \"later\".");
+    }
+
+    vm.run(compile(gc_heap, interned_strings, "var later = 42;"));
+    vm.run(compile(gc_heap, interned_strings, "print f();"));
+
+    BOOST_TEST(os.str() == "42\n");
+}
+
+BOOST_AUTO_TEST_CASE(long_concatenations_will_compare_and_print_by_their_characters)
+{
+    std::ostringstream os;
+    // With no minimum heap, collections happen often, while the ropes are still unflattened.
+    motts::lox::GC_heap gc_heap{/* growth_factor = */ 2.0, /* min_heap_size = */ 0};
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "var s = \"\";"
+        "var t = \"\";"
+        "for (var i = 0; i < 100; i = i + 1) { s = s + \"0123456789\"; t = t + \"0123456789\"; }"
+        "print s == t;"
+        "print s == t + \"!\";"
+        "print s + \"\" == t;"
+        "print \"ab\" + \"c\" == \"abc\";"
+        "print s;"
+    ));
+
+    std::string expected_s;
+    for (auto i = 0; i != 100; ++i) {
+        expected_s += "0123456789";
+    }
+    BOOST_TEST(os.str() == "true\nfalse\ntrue\ntrue\n" + expected_s + "\n");
+}
+
+BOOST_AUTO_TEST_CASE(fused_opcodes_will_run_like_the_sequences_they_replace)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "{"
+        "    var i = 1;"
+        "    var s = \"a\";"
+        "    i = i + 2;"
+        "    s = s + \"b\";"
+        "    print i;"
+        "    print s;"
+        "    print i >= 3;"
+        "    print i <= 2;"
+        "    print i != 3;"
+        "    print s != \"ab\";"
+        "    while (i < 5) i = i + 1;"
+        "    if (i >= 5) print \"then\"; else print \"else\";"
+        "    for (var j = 0; j != 2; j = j + 1) print j;"
+        "}"
+    ));
+    BOOST_TEST(os.str() == "3\nab\ntrue\nfalse\nfalse\nfalse\nthen\n0\n1\n");
+
+    const auto invalid_add_fn = compile(gc_heap, interned_strings, "{ var b = true; b = b + 1; }");
+    BOOST_CHECK_THROW(vm.run(invalid_add_fn), std::runtime_error);
+    try {
+        vm.run(invalid_add_fn);
+    } catch (const std::exception& error) {
+        BOOST_TEST(error.what() == "[Line 1] Error at \"+\": Operands must be two numbers or two strings.");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(folded_constants_will_run_like_the_expressions_they_replace)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "print 1 + 2 * 3;"
+        "print \"a\" + \"b\" == \"ab\";"
+        "print -0;"
+        "print 1 / 0 > 1;"
+        "print nil or \"x\";"
+        "fun f() {"
+        "    var i = 0;"
+        "    while (true) {"
+        "        if (i == 2) return i;"
+        "        i = i + 1;"
+        "    }"
+        "}"
+        "print f();"
+        "for (var i = 0; false; i = i + 1) print i;"
+    ));
+    BOOST_TEST(os.str() == "7\ntrue\n-0\ntrue\nx\n2\n");
+
+    const auto invalid_add_fn = compile(gc_heap, interned_strings, "print 1 + true;");
+    BOOST_CHECK_THROW(vm.run(invalid_add_fn), std::runtime_error);
+    try {
+        vm.run(invalid_add_fn);
+    } catch (const std::exception& error) {
+        BOOST_TEST(error.what() == "[Line 1] Error at \"+\": Operands must be two numbers or two strings.");
+    }
+
+    // A dead branch is never run, but its errors are still reported.
+    BOOST_CHECK_THROW(compile(gc_heap, interned_strings, "if (false) { print; }"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(compaction_between_runs_will_keep_globals_classes_closures_and_strings)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 64 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0.5
+    };
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "class Point { init(x) { this.x = x; } get() { return this.x; } }"
+        "var p = Point(1);"
+        "fun counter() { var n = 0; fun inc() { n = n + 1; return n; } return inc; }"
+        "var c = counter();"
+        "c();"
+        "var s = \"hello\";"
+        "var garbage = nil;"
+        "for (var i = 0; i < 10000; i = i + 1) { var node = Point(i); node.next = garbage; garbage = node; }"
+        "garbage = nil;"
+    ));
+
+    gc_heap.collect_garbage();
+
+    BOOST_TEST(gc_heap.compaction_due() == true);
+    const auto reserved_size_before = gc_heap.reserved_size();
+
+    gc_heap.compact();
+
+    BOOST_TEST(gc_heap.compaction_due() == false);
+    BOOST_TEST(gc_heap.reserved_size() < reserved_size_before);
+
+    vm.run(compile(gc_heap, interned_strings, "print p.get(); print c(); print s + \" world\"; var q = Point(5); print q.x; p.y = 2; print p.y;"));
+
+    BOOST_TEST(os.str() == "1\n2\nhello world\n5\n2\n");
+}
+
+BOOST_AUTO_TEST_CASE(heap_limit_will_raise_out_of_memory_runtime_error)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 64 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0,
+        /* max_heap_size = */ 256 * 1024
+    };
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // Garbage alone never hits the limit.
+    vm.run(compile(gc_heap, interned_strings, "class Node {} for (var i = 0; i < 100000; i = i + 1) { Node(); } print \"ok\";"));
+
+    BOOST_TEST(os.str() == "ok\n");
+
+    try {
+        vm.run(compile(gc_heap, interned_strings, "var head = nil;\nwhile (true) {\n    var node = Node();\n    node.next = head;\n    head = node;\n}"));
+        BOOST_FAIL("Expected an out of memory error.");
+    } catch (const std::runtime_error& error) {
+        BOOST_TEST(error.what() == "[Line 3] Error at \"Node\": Out of memory.");
+    }
+
+    // The error is recoverable. Once the list is dropped, there's room again.
+    vm.run(compile(gc_heap, interned_strings, "head = nil; var node = Node(); print \"recovered\";"));
+
+    BOOST_TEST(os.str() == "ok\nrecovered\n");
+}
+
+BOOST_AUTO_TEST_CASE(heap_limit_will_count_string_chars)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 64 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0,
+        /* max_heap_size = */ 256 * 1024
+    };
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // Each doubling makes one string object of the same control block size, though its characters double once compared.
+    try {
+        vm.run(compile(gc_heap, interned_strings, "var s = \"0123456789abcdef\";\nwhile (true) {\n    s = s + s;\n    s == \"\";\n}"));
+        BOOST_FAIL("Expected an out of memory error.");
+    } catch (const std::runtime_error& error) {
+        BOOST_TEST(error.what() == "[Line 3] Error at \"+\": Out of memory.");
+    }
+
+    vm.run(compile(gc_heap, interned_strings, "s = nil; print \"recovered\";"));
+
+    BOOST_TEST(os.str() == "recovered\n");
+}
+
+BOOST_AUTO_TEST_CASE(heap_limit_will_allow_long_strings_built_by_appending)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 64 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0,
+        /* max_heap_size = */ 8 * 1024 * 1024
+    };
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    // Every rope stays reachable from the last, but only the last is flattened, so only its characters count.
+    vm.run(compile(gc_heap, interned_strings, "var s = \"\";\nfor (var i = 0; i < 20000; i = i + 1) {\n    s = s + \"0123456789\";\n}\nprint s;"));
+
+    BOOST_TEST(os.str().size() == 200001);
+    BOOST_TEST(gc_heap.size() < 8 * 1024 * 1024);
+}
+
+BOOST_AUTO_TEST_CASE(heap_limit_error_will_discard_the_failed_runs_stack)
+{
+    std::ostringstream os;
+    motts::lox::GC_heap gc_heap{
+        /* growth_factor = */ 2.0,
+        /* min_heap_size = */ 64 * 1024,
+        /* mark_slice_budget = */ 0,
+        /* n_mark_threads = */ 1,
+        /* compact_threshold = */ 0,
+        /* max_heap_size = */ 256 * 1024
+    };
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+
+    vm.run(compile(gc_heap, interned_strings, "class Node {} var get;"));
+
+    // The list lives only in a local, and a closure that outlives the run captures another local.
+    try {
+        vm.run(compile(
+            gc_heap,
+            interned_strings,
+            "{\n"
+            "    var tag = \"kept\";\n"
+            "    fun g() { return tag; }\n"
+            "    get = g;\n"
+            "    var head = nil;\n"
+            "    while (true) {\n"
+            "        var node = Node();\n"
+            "        node.next = head;\n"
+            "        head = node;\n"
+            "    }\n"
+            "}"
+        ));
+        BOOST_FAIL("Expected an out of memory error.");
+    } catch (const std::runtime_error& error) {
+        BOOST_TEST(error.what() == "[Line 7] Error at \"Node\": Out of memory.");
+    }
+
+    // The next run's locals start where the failed run's stack did, and there's room again for a live list.
+    vm.run(compile(
+        gc_heap,
+        interned_strings,
+        "var list = nil; for (var i = 0; i < 500; i = i + 1) { var node = Node(); node.next = list; list = node; } print get();"
+    ));
+
+    BOOST_TEST(os.str() == "kept\n");
+}
+
+BOOST_AUTO_TEST_CASE(wide_operands_and_jumps_will_run)
+{
+    std::string source{"fun f() {"};
+    for (auto i = 0; i != 300; ++i) {
+        source += "var l" + std::to_string(i) + " = " + std::to_string(i) + ";";
+    }
+    source += "fun g() { return l299; } l299 = l299 + 1; return g() + l0; } print f();";
+
+    source += "var skip = false; var i = 0; while (i < 2) { print i; i = i + 1; if (skip) {";
+    for (auto i = 0; i != 14'000; ++i) {
+        source += "var g" + std::to_string(i) + " = " + std::to_string(i) + ";";
+    }
+    source += "} } var big = 13999; print big;";
+
+    motts::lox::GC_heap gc_heap;
+    motts::lox::Interned_strings interned_strings{gc_heap};
+    std::ostringstream os;
+    motts::lox::VM vm{gc_heap, interned_strings, os};
+    vm.run(compile(gc_heap, interned_strings, source));
+
+    BOOST_TEST(os.str() == "300\n0\n1\n13999\n");
+}
+
 BOOST_AUTO_TEST_CASE(native_clock_fn_will_run)
 {
     motts::lox::GC_heap gc_heap;
     motts::lox::Interned_strings interned_strings{gc_heap};
 
     auto fn_now = gc_heap.make<motts::lox::Function>({});
-    fn_now->chunk.emit<Opcode::get_global>(interned_strings.get("clock"), Token{interned_strings.get("clock"), 1});
+    emit_global<Opcode::get_global>(fn_now->chunk, interned_strings, "clock", Token{interned_strings.get("clock"), 1});
     fn_now->chunk.emit_call(0, Token{interned_strings.get("clock"), 1});
-    fn_now->chunk.emit<Opcode::define_global>(interned_strings.get("now"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(fn_now->chunk, interned_strings, "now", Token{interned_strings.get("var"), 1});
 
     auto fn_later = gc_heap.make<motts::lox::Function>({});
-    fn_later->chunk.emit<Opcode::get_global>(interned_strings.get("clock"), Token{interned_strings.get("clock"), 1});
+    emit_global<Opcode::get_global>(fn_later->chunk, interned_strings, "clock", Token{interned_strings.get("clock"), 1});
     fn_later->chunk.emit_call(0, Token{interned_strings.get("clock"), 1});
-    fn_later->chunk.emit<Opcode::define_global>(interned_strings.get("later"), Token{interned_strings.get("var"), 1});
+    emit_global<Opcode::define_global>(fn_later->chunk, interned_strings, "later", Token{interned_strings.get("var"), 1});
 
-    fn_later->chunk.emit<Opcode::get_global>(interned_strings.get("later"), Token{interned_strings.get("later"), 1});
-    fn_later->chunk.emit<Opcode::get_global>(interned_strings.get("now"), Token{interned_strings.get("now"), 1});
+    emit_global<Opcode::get_global>(fn_later->chunk, interned_strings, "later", Token{interned_strings.get("later"), 1});
+    emit_global<Opcode::get_global>(fn_later->chunk, interned_strings, "now", Token{interned_strings.get("now"), 1});
     fn_later->chunk.emit<Opcode::greater>(Token{interned_strings.get(">"), 1});
     fn_later->chunk.emit<Opcode::print>(Token{interned_strings.get("print"), 1});
 